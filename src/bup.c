@@ -15,6 +15,7 @@
  *
  * Outputs: if argv[2] != NULL, rename(argv[1], argv[2]) on success.
  *          updates ledger.dat by applying ltran.dat deltas
+ *          writes the entries it changes to undo/u<bnum>.dat
  *          removes transactions from txclean.dat
  *          exit status 0=block update, or non-zero=error.
 */
@@ -42,6 +43,7 @@ void cleanup(int ecode)
    unlink("ledger.tmp");
    unlink("txq.tmp");
    unlink("ltran.dat");
+   unlink("undo.tmp");
    if(Trace) plog("cleanup() exiting with ecode %i", ecode);
    exit(1);
 }
@@ -70,6 +72,9 @@ int main(int argc, char **argv)
    FILE *fpout;
    FILE *bfp;              /* to read the new block */
    FILE *lfp;              /* ledger.dat */
+   FILE *ufp;              /* undo.tmp */
+   LUNDO lu;               /* undo record */
+   char fname[64];
    word32 hdrlen;          /* for block header length */
    unsigned int count;
    word32 *idx;
@@ -245,6 +250,11 @@ noclean:
    if(fp == NULL) bail("Cannot open ltran.dat");
    fpout = fopen("ledger.tmp", "wb");
    if(fpout == NULL) bail("Cannot open ledger.tmp");
+   /* undo.tmp: block hash, then each entry as it was before the block */
+   ufp = fopen("undo.tmp", "wb");
+   if(ufp == NULL) bail("Cannot open undo.tmp");
+   if(fwrite(bt.bhash, 1, HASHLEN, ufp) != HASHLEN)
+      bail("bad write on undo.tmp");
 
    count = fread(&lt, 1, sizeof(LTRAN), fp);  /* read a transaction */
    if(count != sizeof(LTRAN)) teof = 1;
@@ -269,6 +279,11 @@ read_ledger:
          debug("bup: ledger<-->tran addr match");  /* debug */
          /* copy the old ledger entry to a new struct for editing */
          memcpy(&newle, &oldle, sizeof(LENTRY));
+         memset(&lu, 0, sizeof(LUNDO));
+         memcpy(&lu.le, &oldle, sizeof(LENTRY));
+         lu.found = 1;
+         if(fwrite(&lu, 1, sizeof(LUNDO), ufp) != sizeof(LUNDO))
+            bail("bad write on undo.tmp");
 apply_tran:
          memcpy(taddr, lt.addr, TXADDRLEN);  /* save tran address */
 apply2:
@@ -335,6 +350,10 @@ write2:
           */
          memcpy(&newle, lt.addr, TXADDRLEN);
          memset(newle.balance, 0 , 8);  /* but zero balance for apply_tran */
+         memset(&lu, 0, sizeof(LUNDO));
+         memcpy(lu.le.addr, lt.addr, TXADDRLEN);  /* not found */
+         if(fwrite(&lu, 1, sizeof(LUNDO), ufp) != sizeof(LUNDO))
+            bail("bad write on undo.tmp");
          /* Hold old ledger entry to insert before this addition. */
          hold = 1;
          goto apply_tran;
@@ -344,11 +363,15 @@ write2:
    fclose(fp);
    fclose(fpout);
    fclose(lfp);
+   if(fclose(ufp) != 0) bail("bad write on undo.tmp");
    if(nout) {
       /* if there are entries in ledger.tmp */
       unlink("ledger.dat");
       rename("ledger.tmp", "ledger.dat");
       unlink("ltran.dat");   /* may need to archive this */
+      /* keep the undo record for syncup() if there is an undo/ */
+      sprintf(fname, "undo/u%s.dat", bnum2hex(bt.bnum));
+      if(rename("undo.tmp", fname) != 0) unlink("undo.tmp");
    } else {
       unlink("ledger.tmp");  /* remove empty temp file */
       bail("The ledger.dat is empty!");
@@ -107,5 +107,6 @@ int do_neogen(void)
       return error("do_neogen(): cannot read NG block hash");
    memcpy(Cblockhash, bt.bhash, HASHLEN);
    Eon++;
+   rmfiles("undo", NULL);  /* syncup() does not undo past an NG block */
    return VEOK;
 }
@@ -7,47 +7,81 @@
 */
 
 
-/* Receive next packet from NODE *np
- * SOCKET np->sd is already set non-blocking.
- * Returns: VEOK (0) = good, else error code.
- * Check id's if checkids is non-zero.
- * NOTE: Set checkid to zero during handshake.
+/* Read what has arrived of the next packet from NODE *np
+ * without waiting.  *got counts the bytes read so far, and is
+ * zero for a new packet.
+ * The header is read first to size a short (C_VLEN) packet.
+ * Returns: VETIMEOUT if the packet is not all here yet,
+ * VEOK (0) = good, else error code.  Check id's if checkids is non-zero.
  */
-int rx2(NODE *np, int checkids, int seconds)
+int rx_nowait(NODE *np, int *got, int checkids)
 {
-   int count, n;
-   time_t timeout;
+   int count, len, paylen;
    TX *tx;
 
    tx = &np->tx;
-   timeout = time(NULL) + seconds;
-
-   if(Trace)
-      plog("Entering rx() sd = %d  id1 = %x  id2 = %x",
-           np->sd, np->id1, np->id2); /* debug */
-
-   for(n = 0; ; ) {
-      count = recv(np->sd, TXBUFF(tx) + n, TXBUFFLEN - n, 0);
+   for(paylen = TRANLEN, len = TXHDRLEN; ; ) {
+      if(*got >= TXHDRLEN) {
+         /* have the header: size the rest of the packet */
+         if(get16(tx->network) != TXNETWORK)
+            return VEBAD;
+         if(isvlen(tx->version[1], get16(tx->opcode)))
+            paylen = tx_paylen(tx);
+         len = TXHDRLEN + paylen + 4;
+         if(*got >= len) break;
+      }
+      count = recv(np->sd, TXBUFF(tx) + *got, len - *got, 0);
       if(count == 0) return VERROR;
       if(count < 0) {
-         if(time(NULL) >= timeout) return VETIMEOUT;
-         usleep(10);
-         continue;
+         if(errno != EWOULDBLOCK && errno != EINTR) return VERROR;
+         return VETIMEOUT;
       }
-      n += count;
-      if(n == TXBUFFLEN) break;
+      *got += count;
    }  /* end for */
 
+   if(paylen < TRANLEN) {
+      /* move crc16 and trailer into place and clear unused buffer */
+      memmove(tx->crc16, TRANBUFF(tx) + paylen, 4);
+      memset(TRANBUFF(tx) + paylen, 0, TRANLEN - paylen);
+   }
+
    /* check tx and return error codes or count */
-   if(get16(tx->network) != TXNETWORK)
-      return VEBAD;
    if(get16(tx->trailer) != TXEOT)
       return VEBAD;
-   if(crc16(CRC_BUFF(tx), CRC_COUNT) != get16(tx->crc16))
+   if(crc16(CRC_BUFF(tx), TXHDRLEN + paylen) != get16(tx->crc16))
       return VEBAD;
    if(checkids && (np->id1 != get16(tx->id1) || np->id2 != get16(tx->id2)))
       return VEBAD;
+   np->cbits = tx->version[1];
    return VEOK;  /* 0 success */
+}  /* end rx_nowait() */
+
+
+/* Receive next packet from NODE *np
+ * SOCKET np->sd is already set non-blocking.
+ * Returns: VEOK (0) = good, else error code.
+ * Check id's if checkids is non-zero.
+ * NOTE: Set checkid to zero during handshake.
+ */
+int rx2(NODE *np, int checkids, int seconds)
+{
+   int n, status;
+   word32 deadline;
+
+   deadline = mtime() + seconds * 1000;
+
+   if(Trace)
+      plog("Entering rx() sd = %d  id1 = %x  id2 = %x",
+           np->sd, np->id1, np->id2); /* debug */
+
+   for(n = 0; ; ) {
+      status = rx_nowait(np, &n, checkids);
+      if(status != VETIMEOUT) return status;
+      /* sleep until more data or the deadline */
+      status = waitsock(np->sd, POLLIN, deadline);
+      if(status == 0) return VETIMEOUT;
+      if(status < 0) return VERROR;
+   }
 }  /* end rx2() */
 
 
@@ -55,12 +89,17 @@ int rx2(NODE *np, int checkids, int seconds)
 int callserver(NODE *np, word32 ip)
 {
    int ecode;
+   word32 t0;
 
    if(Trace) plog("callserver(): Trying %s...", ntoa((byte *) &ip));
 
    memset(np, 0, sizeof(NODE));   /* clear structure */
+   t0 = mtime();
    np->sd = connectip(ip);  /* returns non-blocked sd */
-   if(np->sd == INVALID_SOCKET) return VERROR;
+   if(np->sd == INVALID_SOCKET) {
+      peer_fail(ip);
+      return VERROR;
+   }
    np->src_ip = ip;
    np->id1 = rand16();
    if(send_op(np, OP_HELLO) != VEOK) goto bad;
@@ -68,6 +107,7 @@ int callserver(NODE *np, word32 ip)
    ecode = rx2(np, 0, ACK_TIMEOUT);
    if(ecode != VEOK) {
       if(Trace) plog("   *** missing HELLO_ACK packet (%d)", ecode);
+      peer_fail(ip);
 bad:
       closesocket(np->sd);
       np->sd = INVALID_SOCKET;
@@ -81,6 +121,7 @@ bad:
       epinklist(ip);
       goto bad;
    }
+   peer_rtt(ip, mtime() - t0);
    return VEOK;
 }  /* end callserver() */
 
@@ -105,35 +146,116 @@ int get_tx2(NODE *np, word32 ip, word16 opcode)
 }  /* end get_tx2() */
 
 
+/* Check that block file fname is block bnum and that its contents
+ * hash to the trailer's bhash.
+ * Returns VEOK if good, else VERROR.
+ */
+int check_bhash(char *fname, byte *bnum)
+{
+   BTRAILER bt;
+   SHA256_CTX ctx;
+   FILE *fp;
+   byte buff[4096], hash[HASHLEN];
+   long len;
+   int n;
+
+   if(readtrailer(&bt, fname) != VEOK) return VERROR;
+   if(cmp64(bt.bnum, bnum) != 0) return VERROR;
+   fp = fopen(fname, "rb");
+   if(fp == NULL) return VERROR;
+   fseek(fp, 0, SEEK_END);
+   len = ftell(fp) - HASHLEN;
+   fseek(fp, 0, SEEK_SET);
+   sha256_init(&ctx);
+   for( ; len > 0; len -= n) {
+      n = len < (long) sizeof(buff) ? len : (long) sizeof(buff);
+      if(fread(buff, 1, n, fp) != (size_t) n) break;
+      sha256_update(&ctx, buff, n);
+   }
+   fclose(fp);
+   if(len > 0) return VERROR;
+   sha256_final(&ctx, hash);
+   if(memcmp(hash, bt.bhash, HASHLEN) != 0) return VERROR;
+   return VEOK;
+}  /* end check_bhash() */
+
+
 /* Get a block or other file from peer, ip.
  * opcode is OP_GETBLOCK or OP_GET_TFILE.
  * bnum can be NULL for OP_GET_FILE.
+ * The download goes to b<bnum>.prt or tfile.prt, which is kept
+ * on error, so that a later call can resume it with OP_GET_RANGE
+ * from the same or another C_OPX peer.  The part is locked while in
+ * use; a second caller downloads to a part of its own, not kept.
+ * An empty part is not kept either.  A finished block must match
+ * its trailer hash.  The file is then renamed to fname.
  * Returns VEOK (0) on good download, else VERROR (1).
  */
 int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode)
 {
    NODE node;
    FILE *fp;
+   RANGEREQ *rq;
    word16 len;
+   long offset;
    int n;
    int ecode = 666;
+   int own = 0;  /* partname is ours alone */
+   word32 t0;
+   char partname[48];
 
    if(Trace) plog("Entering get_block2() Recfile is '%s'", fname);
    show("getblock");
 
-   fp = fopen(fname, "wb");
-   if(fp == NULL)
-      return error("cannot open %s", fname);
-
+   fp = NULL;
    if(callserver(&node, ip) != VEOK)
       goto bad;
-   
+   t0 = mtime();
+
+   if(bnum) sprintf(partname, "b%s.prt", bnum2hex(bnum));
+   else strcpy(partname, "tfile.prt");
+   fp = fopen(partname, "ab");
+   if(fp != NULL && flock(fileno(fp), LOCK_EX | LOCK_NB) != 0) {
+      /* another caller is on it: start one of our own */
+      fclose(fp);
+      if(bnum) sprintf(partname, "b%s.%u.prt", bnum2hex(bnum), (int) getpid());
+      else sprintf(partname, "tfile.%u.prt", (int) getpid());
+      fp = fopen(partname, "wb");
+      own = 1;
+   }
+   if(fp == NULL) {
+      error("cannot open %s", partname);
+      goto bad;
+   }
+   fseek(fp, 0, SEEK_END);
+   offset = ftell(fp);
+
    /* set request block number */
    if(bnum) put64(node.tx.blocknum, bnum);
-   if(send_op(&node, opcode) != VEOK) goto bad;
+   if(offset > 0 && (node.cbits & C_OPX)) {
+      if(Trace) plog("get_block2(): resume %s at %ld", partname, offset);
+      rq = (RANGEREQ *) TRANBUFF(&node.tx);
+      put16(rq->opcode, opcode);
+      put32(rq->offset, offset);
+      put32(rq->length, 0);  /* to EOF */
+      if(send_op(&node, OP_GET_RANGE) != VEOK) goto bad;
+   } else {
+      if(offset > 0) {
+         /* peer cannot resume: start over */
+         if(ftruncate(fileno(fp), 0) != 0) goto bad;
+         offset = 0;
+      }
+      if(send_op(&node, opcode) != VEOK) goto bad;
+   }
    for(;;) {
       if((ecode = rx2(&node, 1, 10)) != VEOK) goto bad;
-      if(get16(node.tx.opcode) != OP_SEND_BL) goto bad; 
+      if(get16(node.tx.opcode) != OP_SEND_BL) {
+         if(get16(node.tx.opcode) == OP_NACK) peer_nack(ip);
+         /* she would not send the rest, so do not ask her again */
+         if(offset > 0 && get16(node.tx.opcode) == OP_NACK)
+            ftruncate(fileno(fp), 0);
+         goto bad;
+      }
       len = get16(node.tx.len);
       if(len > TRANLEN) goto bad;
       if(len) {
@@ -145,16 +267,33 @@ int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode)
       }
       /* check EOF */
       if(len < 1 || n < TRANLEN) {
-         fclose(fp);
+         peer_rate(ip, ftell(fp) - offset, mtime() - t0);
+         fflush(fp);  /* keep the lock until renamed */
          closesocket(node.sd);
          node.sd = INVALID_SOCKET;
+         if(opcode == OP_GETBLOCK && check_bhash(partname, bnum) != VEOK) {
+            if(Trace) plog("get_block2(): bad block hash");
+            unlink(partname);
+            fclose(fp);
+            return VERROR;
+         }
+         if(rename(partname, fname) != 0) {
+            unlink(partname);
+            fclose(fp);
+            return error("get_block2(): cannot rename %s", partname);
+         }
+         fclose(fp);
          if(Trace) plog("get_block2(): EOF");
          return VEOK;
       } /* end if EOF */
    }  /* end for */
 bad:
-   fclose(fp);
-   unlink(fname);  /* delete partial downloads */
+   if(fp) {
+      /* keep a shared partial download to resume, if any */
+      fseek(fp, 0, SEEK_END);
+      if(own || ftell(fp) == 0) unlink(partname);
+      fclose(fp);
+   }
    if(node.sd != INVALID_SOCKET)
       closesocket(node.sd);
    node.sd = INVALID_SOCKET;
@@ -163,3 +302,433 @@ bad:
            ecode, get16(node.tx.len), get16(node.tx.opcode));
    return VERROR;
 }  /* end get_block2() */
+
+
+/* Get count trailers, starting at first, from peer ip's tfile.dat
+ * into buff with OP_TF.  count must not exceed MAXTF.
+ * Returns the number of trailers received, or -1 on error.
+ */
+int get_tf(word32 ip, word32 first, word32 count, BTRAILER *buff)
+{
+   NODE node;
+   word16 len;
+   long n, size;
+
+   if(Trace) plog("get_tf(%s, %u, %u)", ntoa((byte *) &ip), first, count);
+
+   if(callserver(&node, ip) != VEOK) return -1;
+   put32(node.tx.blocknum, first);
+   put32(&node.tx.blocknum[4], count);
+   if(send_op(&node, OP_TF) != VEOK) goto bad;
+   size = count * sizeof(BTRAILER);
+   for(n = 0; ; ) {
+      if(rx2(&node, 1, 10) != VEOK) goto bad;
+      if(get16(node.tx.opcode) != OP_SEND_BL) goto bad;
+      len = get16(node.tx.len);
+      if(len > TRANLEN || n + len > size) goto bad;
+      memcpy((byte *) buff + n, TRANBUFF(&node.tx), len);
+      n += len;
+      if(len < TRANLEN) break;  /* EOF */
+   }
+   closesocket(node.sd);
+   return n / sizeof(BTRAILER);
+bad:
+   closesocket(node.sd);
+   if(Trace) plog("get_tf(): fail opcode = %d", get16(node.tx.opcode));
+   return -1;
+}  /* end get_tf() */
+
+
+/* Append the OP_SEND_BL stream sent by np to fp.
+ * Returns VEOK at EOF, else VERROR.
+ */
+int recv_file(NODE *np, FILE *fp)
+{
+   word16 len;
+
+   for(;;) {
+      if(rx2(np, 1, 10) != VEOK) return VERROR;
+      if(get16(np->tx.opcode) != OP_SEND_BL) return VERROR;
+      len = get16(np->tx.len);
+      if(len > TRANLEN) return VERROR;
+      if(len && fwrite(TRANBUFF(&np->tx), 1, len, fp) != len)
+         return error("recv_file() I/O error");
+      if(len < TRANLEN) return VEOK;  /* EOF */
+   }
+}  /* end recv_file() */
+
+
+/* Get block bnum from peer ip with OP_GETCOMPACT and rebuild it in
+ * fname from the TXQENTRY's in our txclean.dat and txq1.dat.
+ * Only the TX's that we do not have are fetched, with OP_GETTXS.
+ * Returns VEOK if fname has the block with a good hash, else VERROR.
+ */
+int get_compact(word32 ip, byte *bnum, char *fname)
+{
+   static char *qname[3] = { "rtx.tmp", "txclean.dat", "txq1.dat" };
+   NODE node;
+   BHEADER bh;
+   BTRAILER bt;
+   TXQENTRY txe;
+   CTXENTRY *cte;
+   FILE *fp, *qfp[3];
+   long *where;   /* offset of each TXQENTRY in qname[from[j]] */
+   byte *from;    /* 1 or 2 if we have it, else 0 for rtx.tmp */
+   byte *bp;
+   word32 j, k, n, nmiss;
+   int cond, mid, hi, low;
+   long offset;
+   int ecode;
+
+   if(Trace) plog("get_compact(%s, 0x%s)", ntoa((byte *) &ip),
+                  bnum2hex(bnum));
+   show("getcx");
+
+   cte = NULL;
+   where = NULL;
+   from = NULL;
+   memset(qfp, 0, sizeof(qfp));
+   ecode = VERROR;
+
+   /* get header, CTXENTRY's, and trailer */
+   fp = fopen("rcx.tmp", "w+b");
+   if(fp == NULL) return VERROR;
+   if(callserver(&node, ip) != VEOK) goto done;
+   put64(node.tx.blocknum, bnum);
+   if(send_op(&node, OP_GETCOMPACT) != VEOK || recv_file(&node, fp) != VEOK) {
+      closesocket(node.sd);
+      goto done;
+   }
+   closesocket(node.sd);
+   fseek(fp, 0, SEEK_END);
+   offset = ftell(fp) - sizeof(BHEADER) - sizeof(BTRAILER);
+   if(offset <= 0 || (offset % sizeof(CTXENTRY)) != 0) goto done;
+   n = offset / sizeof(CTXENTRY);
+   fseek(fp, 0, SEEK_SET);
+   if(fread(&bh, 1, sizeof(BHEADER), fp) != sizeof(BHEADER)) goto done;
+   if(get32(bh.hdrlen) != sizeof(BHEADER)) goto done;
+   cte = malloc(n * sizeof(CTXENTRY));
+   where = malloc(n * sizeof(long));
+   from = malloc(n);
+   if(cte == NULL || where == NULL || from == NULL) goto done;
+   if(fread(cte, sizeof(CTXENTRY), n, fp) != n) goto done;
+   if(fread(&bt, 1, sizeof(BTRAILER), fp) != sizeof(BTRAILER)) goto done;
+   if(cmp64(bt.bnum, bnum) != 0 || get32(bt.tcount) != n) goto done;
+   memset(from, 0, n);
+
+   /* Find the TX's we have.  The block is sorted by tx_id. */
+   for(k = 1; k < 3; k++) {
+      qfp[k] = fopen(qname[k], "rb");
+      if(qfp[k] == NULL) continue;
+      for(offset = 0; ; offset += sizeof(TXQENTRY)) {
+         if(fread(&txe, 1, sizeof(TXQENTRY), qfp[k]) != sizeof(TXQENTRY))
+            break;
+         for(low = 0, hi = n - 1; low <= hi; ) {
+            mid = (hi + low) / 2;
+            cond = memcmp(txe.tx_id, cte[mid].tx_id, HASHLEN);
+            if(cond == 0) break;
+            if(cond < 0) hi = mid - 1; else low = mid + 1;
+         }
+         if(low > hi || from[mid]) continue;
+         if(get32(cte[mid].crc) != crc32(&txe, sizeof(TXQENTRY))) continue;
+         from[mid] = k;
+         where[mid] = offset;
+      }
+   }
+   for(nmiss = j = 0; j < n; j++) if(from[j] == 0) nmiss++;
+   if(Trace) plog("get_compact(): missing %u of %u TX's", nmiss, n);
+
+   /* Ask her for the rest, up to TRANLEN / 4 at a time. */
+   qfp[0] = fopen(qname[0], "w+b");
+   if(qfp[0] == NULL) goto done;
+   for(j = 0; ; ) {
+      while(j < n && from[j]) j++;
+      if(j >= n) break;
+      if(callserver(&node, ip) != VEOK) goto done;
+      put64(node.tx.blocknum, bnum);
+      for(bp = TRANBUFF(&node.tx); j < n; j++) {
+         if(from[j]) continue;
+         if(bp >= TRANBUFF(&node.tx) + TRANLEN) break;
+         put32(bp, j);
+         bp += 4;
+      }
+      put16(node.tx.len, bp - TRANBUFF(&node.tx));
+      if(send_op(&node, OP_GETTXS) != VEOK
+         || recv_file(&node, qfp[0]) != VEOK) {
+            closesocket(node.sd);
+            goto done;
+      }
+      closesocket(node.sd);
+   }
+   /* which are in rtx.tmp in block order */
+   for(offset = 0, j = 0; j < n; j++) {
+      if(from[j]) continue;
+      where[j] = offset;
+      offset += sizeof(TXQENTRY);
+   }
+   fseek(qfp[0], 0, SEEK_END);
+   if(ftell(qfp[0]) != offset) goto done;
+
+   /* Write the block and check its hash. */
+   fclose(fp);
+   fp = fopen("rcb.tmp", "wb");
+   if(fp == NULL) goto done;
+   if(fwrite(&bh, 1, sizeof(BHEADER), fp) != sizeof(BHEADER)) goto done;
+   for(j = 0; j < n; j++) {
+      if(fseek(qfp[from[j]], where[j], SEEK_SET) != 0) goto done;
+      if(fread(&txe, 1, sizeof(TXQENTRY), qfp[from[j]]) != sizeof(TXQENTRY))
+         goto done;
+      if(fwrite(&txe, 1, sizeof(TXQENTRY), fp) != sizeof(TXQENTRY)) goto done;
+   }
+   if(fwrite(&bt, 1, sizeof(BTRAILER), fp) != sizeof(BTRAILER)) goto done;
+   fclose(fp);
+   fp = NULL;
+   if(check_bhash("rcb.tmp", bnum) != VEOK) {
+      if(Trace) plog("get_compact(): bad block hash");
+      goto done;
+   }
+   if(rename("rcb.tmp", fname) == 0) ecode = VEOK;
+done:
+   if(fp) fclose(fp);
+   for(k = 0; k < 3; k++) if(qfp[k]) fclose(qfp[k]);
+   if(cte) free(cte);
+   if(where) free(where);
+   if(from) free(from);
+   unlink("rcx.tmp");
+   unlink("rtx.tmp");
+   unlink("rcb.tmp");
+   return ecode;
+}  /* end get_compact() */
+
+
+/* Get up to count blocks, starting at bnum, from peer ip in one
+ * OP_GETBLOCKS session.  NG blocks are skipped.  Each block is written
+ * to a temp file and renamed to rb<bnum>.dat when it is complete and
+ * matches its trailer hash, so that the parent can update() it while
+ * the next block arrives.  If fd is not -1, a byte is written to it
+ * for each block.  Peers without C_OPX are asked for one block at a time.
+ * Returns VEOK if all count blocks were received, else VERROR.
+ */
+int get_blocks(word32 ip, byte *bnum, word32 count, int fd)
+{
+   NODE node;
+   FILE *fp;
+   byte bn[8], last[8];
+   word16 len;
+   word32 n[2], t0;
+   long total;
+   int ecode;
+   char fname[64], tmpname[32];
+
+   if(Trace) plog("get_blocks(%s, 0x%s, %u)", ntoa((byte *) &ip),
+                  bnum2hex(bnum), count);
+   show("getblocks");
+
+   sprintf(tmpname, "rb%u.tmp", (int) getpid());
+   put64(bn, bnum);
+   put64(last, bnum);
+   n[0] = count;
+   n[1] = 0;
+   add64(last, n, last);  /* one past the last block wanted */
+
+   if(callserver(&node, ip) != VEOK) return VERROR;
+   if((node.cbits & C_OPX) == 0) {
+      /* older peer: OP_GETBLOCK them one at a time */
+      closesocket(node.sd);
+      for( ; cmp64(bn, last) < 0; add64(bn, One, bn)) {
+         if(bn[0] == 0) continue;  /* do not fetch NG blocks */
+         if(get_block2(ip, bn, tmpname, OP_GETBLOCK) != VEOK)
+            return VERROR;
+         sprintf(fname, "rb%s.dat", bnum2hex(bn));
+         if(rename(tmpname, fname) != 0) break;
+         if(fd != -1) write(fd, "", 1);
+      }
+      unlink(tmpname);
+      return cmp64(bn, last) < 0 ? VERROR : VEOK;
+   }
+
+   /* first block number and count */
+   put32(node.tx.blocknum, get32(bnum));
+   put32(&node.tx.blocknum[4], count);
+   t0 = mtime();
+   total = 0;
+   if(send_op(&node, OP_GETBLOCKS) != VEOK) goto bad;
+   for( ; cmp64(bn, last) < 0; add64(bn, One, bn)) {
+      if(bn[0] == 0) continue;
+      fp = fopen(tmpname, "wb");
+      if(fp == NULL) {
+         error("get_blocks(): cannot open %s", tmpname);
+         goto bad;
+      }
+      for(ecode = VERROR; ; ) {
+         if(rx2(&node, 1, 10) != VEOK) break;
+         /* OP_NACK: peer has no more blocks */
+         if(get16(node.tx.opcode) != OP_SEND_BL) break;
+         if(cmp64(node.tx.blocknum, bn) != 0) break;
+         len = get16(node.tx.len);
+         if(len > TRANLEN) break;
+         if(len && fwrite(TRANBUFF(&node.tx), 1, len, fp) != len) {
+            error("get_blocks() I/O error");
+            break;
+         }
+         total += len;
+         if(len < TRANLEN) { ecode = VEOK; break; }  /* EOF */
+      }
+      fclose(fp);
+      if(ecode != VEOK) goto bad;
+      if(check_bhash(tmpname, bn) != VEOK) {
+         if(Trace) plog("get_blocks(): bad block hash");
+         peer_bad(ip);
+         goto bad;
+      }
+      sprintf(fname, "rb%s.dat", bnum2hex(bn));
+      if(rename(tmpname, fname) != 0) goto bad;
+      if(fd != -1) write(fd, "", 1);
+   }  /* end for bn */
+bad:
+   closesocket(node.sd);
+   unlink(tmpname);
+   peer_rate(ip, total, mtime() - t0);
+   if(Trace) plog("get_blocks(): next was 0x%s", bnum2hex(bn));
+   return cmp64(bn, last) < 0 ? VERROR : VEOK;
+}  /* end get_blocks() */
+
+
+/* Read the block numbers that fetch_wait() sent on fd into want,
+ * keeping the last.  If block is non-zero, wait for one first.
+ * Returns VEOK, or VERROR when the parent has closed fd.
+ */
+int fetch_want(int fd, byte *want, int block)
+{
+   byte buff[8 * 64];
+   int n;
+
+   if(block && waitsock(fd, POLLIN, mtime() + 60000) != 1) return VERROR;
+   for(;;) {
+      n = read(fd, buff, sizeof(buff));
+      if(n == 0) return VERROR;
+      if(n < 0) return errno == EWOULDBLOCK || errno == EINTR ? VEOK : VERROR;
+      if(n >= 8) put64(want, &buff[(n / 8 - 1) * 8]);  /* writes are whole */
+   }
+}  /* end fetch_want() */
+
+
+/* Start a child that fetches blocks with get_blocks() from peer ip,
+ * starting at bnum, until the peer has no more.  She fetches no more
+ * than BLOCKRUN past the block that the parent last waited for, and
+ * writes a byte to fe->rfd for each block she delivers.
+ * Returns VEOK, or VERROR if she could not be started.
+ */
+int fetch_blocks(FETCH *fe, word32 ip, byte *bnum)
+{
+   int rp[2], wp[2];
+   byte bn[8], want[8];
+   word32 n[2];
+
+   fe->pid = 0;
+   fe->rfd = fe->wfd = -1;
+   if(pipe(rp) != 0) return error("fetch_blocks(): cannot pipe()");
+   if(pipe(wp) != 0) {
+      close(rp[0]);
+      close(rp[1]);
+      return error("fetch_blocks(): cannot pipe()");
+   }
+   fe->pid = fork();
+   if(fe->pid < 0) {
+      fe->pid = 0;
+      close(rp[0]);  close(rp[1]);
+      close(wp[0]);  close(wp[1]);
+      return error("fetch_blocks(): cannot fork()");
+   }
+   if(fe->pid) {
+      close(rp[1]);
+      close(wp[0]);
+      fe->rfd = rp[0];
+      fe->wfd = wp[1];
+      nonblock(fe->wfd);  /* she reads only what she needs */
+      fcntl(fe->rfd, F_SETFD, FD_CLOEXEC);
+      fcntl(fe->wfd, F_SETFD, FD_CLOEXEC);
+      return VEOK;
+   }
+   /* in child */
+   signal(SIGTERM, SIG_DFL);  /* fetch_end() may kill us */
+   close(rp[0]);
+   close(wp[1]);
+   nonblock(wp[0]);
+   put64(bn, bnum);
+   put64(want, bnum);
+   n[1] = 0;
+   while(Running) {
+      if(fetch_want(wp[0], want, 0) != VEOK) break;
+      /* wait for the parent to use up the blocks ahead of her,
+       * so that each run is at least half of BLOCKRUN
+       */
+      if(get32(bn) + BLOCKRUN / 2 > get32(want) + BLOCKRUN) {
+         if(fetch_want(wp[0], want, 1) != VEOK) break;
+         continue;
+      }
+      n[0] = get32(want) + BLOCKRUN - get32(bn);
+      if(n[0] > BLOCKRUN) n[0] = BLOCKRUN;
+      if(get_blocks(ip, bn, n[0], rp[1]) != VEOK) break;
+      add64(bn, n, bn);
+   }
+   exit(0);
+}  /* end fetch_blocks() */
+
+
+/* Reap the fetch_blocks() child fe, and close her pipes. */
+void fetch_close(FETCH *fe)
+{
+   if(fe->pid > 0) waitpid(fe->pid, NULL, 0);
+   if(fe->rfd != -1) close(fe->rfd);
+   if(fe->wfd != -1) close(fe->wfd);
+   fe->pid = 0;
+   fe->rfd = fe->wfd = -1;
+}  /* end fetch_close() */
+
+
+/* Wait for the fetch_blocks() child fe to deliver block bnum, and let
+ * her fetch up to BLOCKRUN past it.  Sets fname to its file, rb<bnum>.dat.
+ * Returns VEOK when fname exists, else VERROR once the child has
+ * exited without it.  fe->pid is zeroed when the child has been reaped.
+ */
+int fetch_wait(FETCH *fe, byte *bnum, char *fname)
+{
+   char buff[BLOCKRUN];
+   int n;
+
+   sprintf(fname, "rb%s.dat", bnum2hex(bnum));
+   if(fe->pid) write(fe->wfd, bnum, 8);
+   while(Running) {
+      if(exists(fname)) return VEOK;
+      if(fe->pid == 0) break;
+      /* sleep until she delivers a block or exits */
+      if(waitsock(fe->rfd, POLLIN, mtime() + 1000) != 1) continue;
+      n = read(fe->rfd, buff, sizeof(buff));
+      if(n == 0 || (n < 0 && errno != EINTR && errno != EWOULDBLOCK))
+         fetch_close(fe);  /* she may have renamed one last file */
+   }
+   return VERROR;
+}  /* end fetch_wait() */
+
+
+/* Stop a fetch_blocks() child and remove the blocks that she
+ * delivered from bnum on.
+ */
+void fetch_end(FETCH *fe, byte *bnum)
+{
+   byte bn[8];
+   char fname[64];
+
+   if(fe->pid) {
+      kill(fe->pid, SIGTERM);
+      sprintf(fname, "rb%u.tmp", (int) fe->pid);
+      fetch_close(fe);
+      unlink(fname);
+   }
+   for(put64(bn, bnum); ; add64(bn, One, bn)) {
+      if(bn[0] == 0) continue;
+      sprintf(fname, "rb%s.dat", bnum2hex(bn));
+      if(unlink(fname) != 0) break;
+   }
+}  /* end fetch_end() */
@@ -0,0 +1,194 @@
+/* chkpoint.c  Trusted checkpoints of tfile.dat.
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * A checkpoint names a block deep in the chain by its number, its
+ * bhash, and the sha256 of trailers 0 through that block in tfile.dat:
+ *
+ *    head -c $(( (bnum + 1) * 160 )) tfile.dat | sha256sum
+ *
+ * The bhash alone would not do, since nothing in a trailer proves its
+ * bhash but the work of the next trailer.  When a tfile.dat matches a
+ * checkpoint, tfval2() skips the proof of work of the trailers up to
+ * it, but still checks their links, times, and difficulty.
+ *
+ * Checkpoints come from Checkpt[] below and from lines in Ckfname:
+ *
+ *    # bnum   bhash   tfile hash  (hex)
+ *    0x40000  9e1c...  5d0a...
+ *
+ * -C checks the work of every trailer and ignores them.
+*/
+
+/* Checkpoints known at release, lowest bnum first, ended by a zero
+ * bnum.  There are none yet.
+ */
+CHECKPOINT Checkpt[MAXCHECKPT] = {
+   { 0 }
+};
+int Ncheckpt;  /* entries in Checkpt[] */
+
+char *Ckfname = "checkpt.lst";  /* more checkpoints, if it exists */
+
+
+/* Convert HASHLEN bytes of hex to hash.
+ * Returns VEOK, or VERROR if hex is not that much hex.
+ */
+int hex2hash(byte *hash, char *hex)
+{
+   static char hextab[] = "0123456789abcdef";
+   char *hi, *lo;
+   int j;
+
+   if(hex == NULL || strlen(hex) != HASHLEN * 2) return VERROR;
+   for(j = 0; j < HASHLEN; j++, hex += 2) {
+      hi = strchr(hextab, tolower(hex[0]));
+      lo = strchr(hextab, tolower(hex[1]));
+      if(!hi || !lo) return VERROR;
+      hash[j] = (hi - hextab) * 16 + (lo - hextab);
+   }
+   return VEOK;
+}  /* end hex2hash() */
+
+
+/* Find the checkpoint at bnum.
+ * Returns NULL if there is none.
+ */
+CHECKPOINT *checkpt_find(word32 bnum)
+{
+   int j;
+
+   for(j = 0; j < Ncheckpt; j++)
+      if(Checkpt[j].bnum == bnum) return &Checkpt[j];
+   return NULL;
+}
+
+
+/* Add checkpoints from the text file fname, keeping Checkpt[] sorted.
+ * If a line names a checkpoint already known with other hashes, the
+ * file is not used.
+ * Returns the number of checkpoints added, or -1 on error.
+ */
+int read_checkpt(char *fname)
+{
+   static CHECKPOINT save[MAXCHECKPT];
+   FILE *fp;
+   CHECKPOINT cp, *known;
+   char buff[256], *bstr, *hstr, *tstr;
+   int j, n, nsave, line;
+
+   if(fname == NULL || *fname == '\0') return 0;
+   fp = fopen(fname, "rb");
+   if(fp == NULL) return 0;
+   memcpy(save, Checkpt, sizeof(save));
+   nsave = Ncheckpt;
+   for(n = line = 0; fgets(buff, sizeof(buff), fp) != NULL; ) {
+      line++;
+      if(*buff == '#') continue;
+      bstr = strtok(buff, " \r\n\t");
+      if(bstr == NULL) continue;
+      hstr = strtok(NULL, " \r\n\t");
+      tstr = strtok(NULL, " \r\n\t");
+      memset(&cp, 0, sizeof(CHECKPOINT));
+      cp.bnum = strtoul(bstr, NULL, 0);
+      if(cp.bnum == 0 || hex2hash(cp.bhash, hstr) != VEOK
+         || hex2hash(cp.tfhash, tstr) != VEOK) {
+         error("read_checkpt(): %s line %d is bad", fname, line);
+         continue;
+      }
+      known = checkpt_find(cp.bnum);
+      if(known) {
+         if(memcmp(known, &cp, sizeof(CHECKPOINT)) == 0) continue;
+         fclose(fp);
+         memcpy(Checkpt, save, sizeof(save));
+         Ncheckpt = nsave;
+         error("read_checkpt(): %s line %d conflicts at 0x%x",
+               fname, line, cp.bnum);
+         return -1;
+      }
+      if(Ncheckpt >= MAXCHECKPT) {
+         error("read_checkpt(): more than %d checkpoints", MAXCHECKPT);
+         break;
+      }
+      /* insert in order */
+      for(j = Ncheckpt; j > 0 && Checkpt[j - 1].bnum > cp.bnum; j--)
+         memcpy(&Checkpt[j], &Checkpt[j - 1], sizeof(CHECKPOINT));
+      memcpy(&Checkpt[j], &cp, sizeof(CHECKPOINT));
+      Ncheckpt++;
+      n++;
+   }
+   fclose(fp);
+   if(n) plog("%d checkpoints from %s", n, fname);
+   return n;
+}  /* end read_checkpt() */
+
+
+/* Count the built-in checkpoints and add those in fname.
+ * Returns the number of checkpoints.
+ */
+int init_checkpt(char *fname)
+{
+   for(Ncheckpt = 0; Ncheckpt < MAXCHECKPT; Ncheckpt++)
+      if(Checkpt[Ncheckpt].bnum == 0) break;
+   read_checkpt(fname);
+   if(Trace) plog("init_checkpt(): %d checkpoints", Ncheckpt);
+   return Ncheckpt;
+}
+
+
+/* Returns non-zero if bt is at a checkpoint with another bhash. */
+int checkpt_bad(BTRAILER *bt)
+{
+   CHECKPOINT *cp;
+
+   if(Ncheckpt == 0 || get32(bt->bnum + 4) != 0) return 0;
+   cp = checkpt_find(get32(bt->bnum));
+   return cp && memcmp(cp->bhash, bt->bhash, HASHLEN) != 0;
+}
+
+
+/* fp is at the trailer of block first in tfile.dat.  Find the highest
+ * checkpoint in the next count trailers, or all to EOF if count is
+ * zero, and check that the file matches it.
+ * Returns the number of trailers from first through that checkpoint,
+ * whose work need not be checked, or zero.  fp is left where it was.
+ */
+word32 checkpt_skip(FILE *fp, word32 first, word32 count)
+{
+   BTRAILER bt;
+   CHECKPOINT *cp;
+   byte hash[HASHLEN];
+   long offset, filelen;
+   word32 last;
+   int j;
+
+   if(Tfcheckall || Ncheckpt == 0) return 0;
+   offset = ftell(fp);
+   if(offset < 0 || fseek(fp, 0, SEEK_END) != 0) return 0;
+   filelen = ftell(fp);
+   last = filelen / sizeof(BTRAILER);  /* one past the last trailer */
+   if(count && first + count < last) last = first + count;
+   for(cp = NULL, j = Ncheckpt - 1; j >= 0; j--) {
+      if(Checkpt[j].bnum >= first && Checkpt[j].bnum < last) {
+         cp = &Checkpt[j];
+         break;
+      }
+   }
+   if(cp == NULL) goto out;
+   if(fseek(fp, (long) cp->bnum * sizeof(BTRAILER), SEEK_SET) != 0
+      || fread(&bt, 1, sizeof(BTRAILER), fp) != sizeof(BTRAILER)
+      || memcmp(bt.bhash, cp->bhash, HASHLEN) != 0
+      || tfhash(fp, cp->bnum + 1, hash) != VEOK
+      || memcmp(hash, cp->tfhash, HASHLEN) != 0) {
+      plog("checkpt_skip(): tfile does not match checkpoint 0x%x", cp->bnum);
+      cp = NULL;
+   }
+out:
+   fseek(fp, offset, SEEK_SET);
+   if(cp == NULL) return 0;
+   if(Trace) plog("checkpt_skip(): to 0x%x", cp->bnum);
+   return cp->bnum - first + 1;
+}  /* end checkpt_skip() */
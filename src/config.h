@@ -56,7 +56,19 @@
 #define MAXNODES      37       /* maximum number of connected nodes  */
 #define LQLEN         100      /* listen() queue length              */
 #define INIT_TIMEOUT  3        /* initial timeout after accept()     */
+#define PENDLEN       32       /* accepted sockets held by server()  */
+#define BALMAX        1024     /* most queries in one OP_BALANCES    */
+#define QUERYPROCS    4        /* OP_BALANCE/OP_RESOLVE workers  -Q  */
+#define MAXPOWPROCS   64       /* most tfile PoW checkers        -W  */
+#define POWCHUNK      1024     /* trailers per PoW checker chunk     */
+#define TFCHECKFREQ   256      /* blocks between tfile checkpoints   */
+#define TFCHECKS      8        /* tfile check states kept in memory  */
+#define TFSUMEXTRA    4096     /* tfmap() weights to grow into       */
+#define POWCACHELEN   4096     /* slots in powcache.dat              */
+#define PREVALAHEAD   128      /* blocks get_eon() checks ahead      */
+#define MAXCHECKPT    64       /* tfile checkpoints in Checkpt[]     */
 #define ACK_TIMEOUT   10       /* timeout in callserver()            */
+#define FOUNDTIME     15       /* deadline for OP_FOUND to each peer */
 #define TXQUEBIG      32       /* big enough to run bcon             */
 #define MAXBLTX       32768    /* max TX's in a block for bcon (~1M) */
 #define STATUSFREQ    10       /* status display interval sec.       */
@@ -69,11 +81,30 @@
 #define EPOCHSHIFT    4
 #define RPLISTLEN     32       /* recent peer list v.28 */
 #define CPLISTLEN     8        /* current peer list */
-#define CRCLISTLEN    1024     /* recent tx crc's */
+#define CRCLISTLEN    1024     /* recent tx_id's in Txseen[]         */
+#define TXSEENPROBE   8        /* Txseen[] slots searched for tx_id  */
+#define TXSEENTIME    600      /* seconds a tx_id stays in Txseen[]  */
 #define MAXQUORUM     8        /* for get_eon() gang[] */
+#define IPLPROBES     16       /* peers get_ipls() asks at once      */
+#define IPLPEERTIME   4        /* seconds for one peer to answer     */
+#define IPLWAIT       6        /* seconds get_ipls() waits in all    */
+#define BLOCKRUN      128      /* max blocks sent per OP_GETBLOCKS   */
+#define MAXTF         1000     /* max trailers sent per OP_TF        */
+#define PEERLEN       512      /* peer scores kept in peers.dat      */
+#define PEERPROBE     16       /* slots searched for a peer score    */
+#define PEERAGE       64       /* halve peer counts after this many  */
+#define PEERSCALE     1000000  /* peer score of 1 ms round trip      */
+#define PEERRTT       500      /* ms round trip of an unknown peer   */
+#define PEERRATE      65536    /* bytes/sec that doubles peer score  */
+#define LIMITLEN      1024     /* ip's with OP_TX token buckets      */
+#define LIMITPROBE    8        /* buckets searched for an ip         */
+#define TXIPRATE      10       /* OP_TX per second from one ip  -r   */
+#define TXIPBURST     100      /* burst of OP_TX from one ip         */
+#define TXRATE        200      /* OP_TX validated per second    -R   */
+#define TXBURST       1000     /* burst of OP_TX validated           */
 
 #define BCONFREQ   10     /* Run con at least */
-#define CBITS      0      /* 8 capability bits for TX */
+#define CBITS      96     /* 8 capability bits for TX: C_VLEN|C_OPX */
 /* Historic Compatibility Break Point Triggers */
 #define DTRIGGER31 17185  /* for v2.0 new set_difficulty() */
 #define WTRIGGER31 17185  /* for v2.0 new add_weight() */
@@ -11,7 +11,8 @@ SOCKET connectip(word32 ip)
    SOCKET sd;
    struct sockaddr_in addr;
    word16 port;
-   time_t timeout;
+   unsigned len;
+   int err;
 
    if((sd = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET) {
       error("connectip(): cannot open socket.");
@@ -26,15 +27,17 @@ SOCKET connectip(word32 ip)
    addr.sin_port = htons(port);
 
    nonblock(sd);  /* was after connect() v.21 */
-   timeout = time(NULL) + 3;
-retry:
-   if(connect(sd, (struct sockaddr *) &addr, sizeof(struct sockaddr))) {
-      if(errno == EISCONN) return sd;
-      if((errno == EINPROGRESS || errno == EALREADY)
-         && time(NULL) < timeout) goto retry;
-      closesocket(sd);
-      if(Trace) plog("connectip(): cannot connect(0x%08x):%d.", ip, port);
-      return INVALID_SOCKET;
+   if(connect(sd, (struct sockaddr *) &addr, sizeof(struct sockaddr)) == 0)
+      return sd;
+   if(errno == EINPROGRESS || errno == EALREADY || errno == EWOULDBLOCK) {
+      /* sleep until connected, refused, or 3 seconds pass */
+      if(waitsock(sd, POLLOUT, mtime() + 3000) == 1) {
+         len = sizeof(err);
+         if(getsockopt(sd, SOL_SOCKET, SO_ERROR, (char *) &err, &len) == 0
+            && err == 0) return sd;
+      }
    }
-   return sd;
+   closesocket(sd);
+   if(Trace) plog("connectip(): cannot connect(0x%08x):%d.", ip, port);
+   return INVALID_SOCKET;
 }  /* end connectip() */
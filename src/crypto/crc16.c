@@ -51,13 +51,39 @@ word16 Crc16table[] = {
 #define update_crc16(crc, c) \
    ( ((word16) (crc) << 8) ^ Crc16table[ ((word16) (crc) >> 8) ^ (byte) (c) ] )
 
-/* Compute CRC-CCITT on buff */
+/* Crc16table[] for 1 to 7 more bytes after it, for slice-by-8:
+ * Crc16slice[k][i] is Crc16table[i] run through k zero bytes.
+ */
+word16 Crc16slice[8][256];
+int Crc16init;
+
+void crc16_init(void)
+{
+   int k, i;
+
+   for(i = 0; i < 256; i++) Crc16slice[0][i] = Crc16table[i];
+   for(k = 1; k < 8; k++)
+      for(i = 0; i < 256; i++)
+         Crc16slice[k][i] = update_crc16(Crc16slice[k - 1][i], 0);
+   Crc16init = 1;
+}
+
+
+/* Compute CRC-CCITT on buff, eight bytes at a time */
 word16 crc16(void *buff, int len)
 {
    word16 crc = 0;
    byte *bp;
 
-   for(bp = buff; len; len--, bp++)
+   if(!Crc16init) crc16_init();
+   for(bp = buff; len >= 8; len -= 8, bp += 8) {
+      crc = Crc16slice[7][(crc >> 8) ^ bp[0]]
+          ^ Crc16slice[6][(crc & 0xff) ^ bp[1]]
+          ^ Crc16slice[5][bp[2]] ^ Crc16slice[4][bp[3]]
+          ^ Crc16slice[3][bp[4]] ^ Crc16slice[2][bp[5]]
+          ^ Crc16slice[1][bp[6]] ^ Crc16slice[0][bp[7]];
+   }
+   for( ; len; len--, bp++)
       crc = update_crc16(crc, *bp);  /* macro so no side-effects, please */
 
    return crc;
@@ -27,6 +27,7 @@ word32 Nsent;        /* total TX sent                             */
 word32 Ngen;         /* total number of main loop iterations      */
 word32 Nsenderr;     /* number of send errors                     */
 word32 Ndups;        /* number of dup TX's received               */
+word32 Nlimited;     /* OP_TX's refused by tx_admit()             */
 word32 Nsolved;      /* number of blocks solved by miner          */
 word32 Nupdated;     /* number of blocks updated                  */
 word32 Eon;          /* Eons since boot                           */
@@ -37,6 +38,8 @@ word32 Sanctuary;
 word32 Lastday;
 byte Exportflag;     /* enable database export if BX_MYSQL defined */
 word32 Trustblock;
+byte Tfcheckall;     /* -C to validate all of tfile.dat in init()   */
+word32 Tfcheckblock; /* block number at last tfcheck_save()         */
 
 /*
  * real time of current server loop - set by server()
@@ -52,6 +55,10 @@ char *Ngdir = NGDIR;     /* block chain directory */
 #ifndef EXCLUDE_NODES
 NODE Nodes[MAXNODES];  /* data structure for connected NODE's     */
 NODE *Hi_node = Nodes; /* points one beyond last logged in NODE   */
+TXSEEN Txseen[CRCLISTLEN];  /* recent TX's for txseen()            */
+PENDING Pending[PENDLEN];  /* accepted and waiting for dispatch()   */
+word32 Qdepth[NPRI];       /* requests waiting in each class         */
+word32 Qmax[NPRI];         /* most requests waited in each class     */
 
 word32 Rplist[RPLISTLEN];  /* recent peer list */
 word32 Rplistidx;
@@ -119,6 +119,7 @@ void fatal2(int exitcode, char *message)
    if(Sendfound_pid) kill(Sendfound_pid, SIGTERM);
 #ifndef EXCLUDE_NODES
    stop_mirror();
+   stop_query();
 #endif
    if(!Bgflag && message) {
       error("%s", message);
@@ -39,6 +39,95 @@ int send_balance(NODE *np)
    return 0;  /* success */
 } /* end send_balance() */
 
+
+/* Order of OP_BALANCES queries for qsort() in send_balances() */
+static LENTRY *Balq;
+
+int balcmp(const void *a, const void *b)
+{
+   return memcmp(Balq[*((word32 *) a)].addr, Balq[*((word32 *) b)].addr,
+                 TXADDRLEN);
+}
+
+
+/* Send balances for the queries in OP_BALANCES packets from np.
+ * The first packet is in np->tx, and more follow while they are
+ * full with BALPKT queries.  tx.len is the byte count.
+ * Each TXADDRLEN query is one of:
+ *     an address with a zero tag to find without its tag,
+ *     a zero address with a tag at ADDR_TAG_PTR() to resolve,
+ *     or a full address.
+ * Replies with a LENTRY for each query, in order, from memory:
+ * the found address and balance, or the query and a zero balance.
+ * Queries are looked up in sorted order so that each search starts
+ * where the one before it ended, and all tags are resolved in one
+ * pass over the tag index.  -- called by child
+ * Returns VEOK on success, else VERROR.
+ */
+int send_balances(NODE *np)
+{
+   LENTRY *q, le;
+   word32 *idx, j, m, n;
+   byte *bp;
+   long low, pos;
+   int len, mode, status;
+
+   show("sendbals");
+   q = malloc(BALMAX * sizeof(LENTRY));
+   idx = malloc(BALMAX * sizeof(word32));
+   if(q == NULL || idx == NULL) goto nack;
+
+   /* collect the queries */
+   for(n = 0; ; ) {
+      len = get16(np->tx.len);
+      if(len > BALPKT * TXADDRLEN || (len % TXADDRLEN) != 0) goto nack;
+      if(n + len / TXADDRLEN > BALMAX) goto nack;
+      for(bp = TRANBUFF(&np->tx); len > 0; bp += TXADDRLEN, len -= TXADDRLEN) {
+         memcpy(q[n].addr, bp, TXADDRLEN);
+         memset(q[n].balance, 0, TXAMOUNT);
+         idx[n] = n;
+         n++;
+      }
+      if(get16(np->tx.len) < BALPKT * TXADDRLEN) break;
+      if(rx2(np, 1, 10) != VEOK || get16(np->tx.opcode) != OP_BALANCES)
+         goto bad;
+   }
+   if(Trace) plog("send_balances(): %u queries", n);
+
+   /* A child needs her own file offset in ledger.dat. */
+   Lefp = NULL;
+   if(le_open("ledger.dat", "rb") != VEOK) goto nack;
+   Balq = q;
+   qsort(idx, n, sizeof(word32), balcmp);
+   /* tag queries sort first, in order of tag */
+   for(m = 0; m < n; m++)
+      if(!iszero(q[idx[m]].addr, TXADDRLEN - ADDR_TAG_LEN)) break;
+   if(tag_findq(q, idx, m) < 0) goto nack;
+   for(low = 0, j = m; j < n; j++) {
+      bp = q[idx[j]].addr;
+      mode = ADDR_TAG_PTR(bp)[0] == 0;
+      if(le_find2(bp, &le, &pos, mode, low)) {
+         memcpy(bp, le.addr, TXADDRLEN);
+         memcpy(q[idx[j]].balance, le.balance, TXAMOUNT);
+      }
+      if(mode == 0) low = pos;
+   }
+
+   free(idx);
+   send_begin(np);
+   status = send_add(np, q, n * sizeof(LENTRY));
+   if(status == VEOK) status = send_end(np);
+   free(q);
+   return status;
+nack:
+   sendnack(np);
+bad:
+   if(idx) free(idx);
+   if(q) free(q);
+   return VERROR;
+}  /* end send_balances() */
+
+
 int sendnack(NODE *np)
 {
    put16(np->tx.opcode, OP_NACK);
@@ -55,43 +144,33 @@ void sendalrm(int sig)
    exit(1);  /* fail */
 }
 
-/* Send block to peer  -- called by child
- * Return VERROR on file errors or reset connection, else VEOK.
+/* Send length bytes of open file fd to peer, starting at offset,
+ * with pread() so that no file position is shared.
+ * A length of zero sends to EOF.
+ * The last OP_SEND_BL has less than TRANLEN bytes.  -- called by child
+ * Return VERROR on read errors or reset connection, else VEOK.
  */
-int send_file(NODE *np, char *fname)
+int send_fd(NODE *np, int fd, long offset, long length)
 {
-   byte *bnum;
    TX *tx;
    int n, status;
-   FILE *fp;
-   char name[128];
 
    tx = &np->tx;
-   bnum = tx->blocknum;
-
-   show("send");
-
-   if(fname == NULL) {
-      sprintf(name, "%s/b%s.bc", Bcdir, bnum2hex(bnum));
-      fname = name;
-   }
-   fp = fopen(fname, "rb");
-   if(fp == NULL) {
-      if(Trace) plog("cannot open %s", fname);
-      sendnack(np);
-      return VERROR;
-   }
-   if(Trace) plog("sending %s", fname);
+   if(length == 0) length = -1;  /* to EOF */
    blocking(np->sd);   /* set blocking I/O for send() */
    signal(SIGALRM, sendalrm);  /* set timeout handler */
    for(; Running; ) {
-      n = fread(TRANBUFF(tx), 1, TRANLEN, fp);
+      n = TRANLEN;
+      if(length >= 0 && length < TRANLEN) n = length;
+      n = pread(fd, TRANBUFF(tx), n, offset);
+      if(n < 0) break;
+      offset += n;
+      if(length > 0) length -= n;
       put16(tx->len, n);
       alarm(10);
       status = send_op(np, OP_SEND_BL);
       if(n < TRANLEN) {
          alarm(0);
-         fclose(fp);
          return status;  /* VEOK or VERROR -- server does freeslot() */
       }
       if(status != VEOK) break;
@@ -99,9 +178,243 @@ int send_file(NODE *np, char *fname)
       if(Nonline > 1) usleep((Nonline - 1) * UBANDWIDTH);
    }  /* end for(; Running; ) */
    alarm(0);
+   return VERROR;
+}  /* end send_fd() */
+
+
+/* Start an OP_SEND_BL stream to peer made with send_add() and
+ * send_end(), for a reply built in memory.  -- called by child
+ */
+void send_begin(NODE *np)
+{
+   blocking(np->sd);   /* set blocking I/O for send() */
+   signal(SIGALRM, sendalrm);  /* set timeout handler */
+   put16(np->tx.len, 0);
+}
+
+
+/* Add len bytes at buff to the stream, sending each packet as it
+ * fills.  tx.len counts the bytes waiting in TRANBUFF(tx).
+ * Return VERROR on reset connection, else VEOK.
+ */
+int send_add(NODE *np, void *buff, long len)
+{
+   TX *tx;
+   byte *bp;
+   int n, status;
+
+   tx = &np->tx;
+   for(bp = buff; len > 0; bp += n, len -= n) {
+      n = TRANLEN - get16(tx->len);
+      if(n > len) n = len;
+      memcpy(TRANBUFF(tx) + get16(tx->len), bp, n);
+      put16(tx->len, get16(tx->len) + n);
+      if(get16(tx->len) < TRANLEN) continue;
+      if(!Running) return VERROR;
+      alarm(10);
+      status = send_op(np, OP_SEND_BL);
+      alarm(0);
+      if(status != VEOK) return VERROR;
+      put16(tx->len, 0);
+      /* Make upload bandwidth dynamic. */
+      if(Nonline > 1) usleep((Nonline - 1) * UBANDWIDTH);
+   }
+   return VEOK;
+}  /* end send_add() */
+
+
+/* Send the last packet of the stream, with less than TRANLEN bytes.
+ * Return VERROR on reset connection, else VEOK.
+ */
+int send_end(NODE *np)
+{
+   int status;
+
+   alarm(10);
+   status = send_op(np, OP_SEND_BL);
+   alarm(0);
+   return status;
+}
+
+
+/* Send length bytes of a block or file to peer, starting at offset.
+ * A length of zero sends to EOF.  fname NULL means tx.blocknum's block.
+ * -- called by child
+ * Return VERROR on file errors or reset connection, else VEOK.
+ */
+int send_part(NODE *np, char *fname, long offset, long length)
+{
+   int fd, status;
+   char name[128];
+
+   show("send");
+
+   if(fname == NULL) {
+      sprintf(name, "%s/b%s.bc", Bcdir, bnum2hex(np->tx.blocknum));
+      fname = name;
+   }
+   fd = open(fname, O_RDONLY);
+   if(fd == -1 || offset < 0) {
+      if(Trace) plog("cannot open %s at %ld", fname, offset);
+      if(fd != -1) close(fd);
+      sendnack(np);
+      return VERROR;
+   }
+   if(Trace) plog("sending %s", fname);
+   status = send_fd(np, fd, offset, length);
+   close(fd);
+   return status;
+}  /* end send_part() */
+
+
+/* Send block to peer  -- called by child
+ * Return VERROR on file errors or reset connection, else VEOK.
+ */
+int send_file(NODE *np, char *fname)
+{
+   return send_part(np, fname, 0, 0);
+}
+
+
+/* Send part of a block or tfile.dat in response to OP_GET_RANGE.
+ * See RANGEREQ in types.h.  -- called by child
+ * Return VERROR on errors, else VEOK.
+ */
+int send_range(NODE *np)
+{
+   RANGEREQ *rq;
+   char *fname;
+
+   rq = (RANGEREQ *) TRANBUFF(&np->tx);
+   switch(get16(rq->opcode)) {
+      case OP_GETBLOCK:  fname = NULL;  break;
+      case OP_GET_TFILE: fname = "tfile.dat";  break;
+      default:
+         sendnack(np);
+         return VERROR;
+   }
+   return send_part(np, fname, get32(rq->offset), get32(rq->length));
+}  /* end send_range() */
+
+
+/* Send a run of blocks to peer in response to OP_GETBLOCKS.
+ * tx.blocknum[0..3] is the first block and [4..7] the count.
+ * Each block is sent as with OP_GETBLOCK, and tx.blocknum is set
+ * to the block in each OP_SEND_BL.  NG blocks are skipped.
+ * send_file() sends OP_NACK if we do not have a block.
+ * Called by child.  Returns VEOK on success, else VERROR.
+ */
+int send_blocks(NODE *np)
+{
+   byte bnum[8];
+   word32 count;
+
+   put64(bnum, np->tx.blocknum);
+   bnum[4] = bnum[5] = bnum[6] = bnum[7] = 0;
+   count = get32(&np->tx.blocknum[4]);
+   if(count > BLOCKRUN) count = BLOCKRUN;
+   for( ; count && Running; count--, add64(bnum, One, bnum)) {
+      if(bnum[0] == 0) continue;  /* NG blocks are made by each node */
+      put64(np->tx.blocknum, bnum);
+      if(send_file(np, NULL) != VEOK) return VERROR;
+   }
+   return VEOK;
+}  /* end send_blocks() */
+
+
+/* Send block tx.blocknum in compact form in response to OP_GETCOMPACT:
+ * its BHEADER, a CTXENTRY for each TXQENTRY, and its BTRAILER,
+ * made as the block is read.
+ * Called by child.  Returns VEOK on success, else VERROR.
+ */
+int send_compact(NODE *np)
+{
+   BHEADER bh;
+   BTRAILER bt;
+   TXQENTRY txe;
+   CTXENTRY cte;
+   FILE *fp;
+   word32 n;
+   char fname[128];
+
+   show("sendcx");
+   sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(np->tx.blocknum));
+   if(readtrailer(&bt, fname) != VEOK) goto nack;
+   n = get32(bt.tcount);
+   /* only normal blocks have TXQENTRY's */
+   if(n == 0) goto nack;
+   fp = fopen(fname, "rb");
+   if(fp == NULL) goto nack;
+   if(fread(&bh, 1, sizeof(BHEADER), fp) != sizeof(BHEADER)
+      || get32(bh.hdrlen) != sizeof(BHEADER)) {
+      fclose(fp);
+      goto nack;
+   }
+   send_begin(np);
+   if(send_add(np, &bh, sizeof(BHEADER)) != VEOK) goto bad;
+   for( ; n; n--) {
+      if(fread(&txe, 1, sizeof(TXQENTRY), fp) != sizeof(TXQENTRY)) goto bad;
+      memcpy(cte.tx_id, txe.tx_id, HASHLEN);
+      put32(cte.crc, crc32(&txe, sizeof(TXQENTRY)));
+      if(send_add(np, &cte, sizeof(CTXENTRY)) != VEOK) goto bad;
+   }
    fclose(fp);
+   if(send_add(np, &bt, sizeof(BTRAILER)) != VEOK) return VERROR;
+   return send_end(np);
+bad:
+   fclose(fp);  /* peer sees a short stream */
+   return VERROR;
+nack:
+   sendnack(np);
+   return VERROR;
+}  /* end send_compact() */
+
+
+/* Send the TXQENTRY's of block tx.blocknum whose indexes are listed
+ * as 4-byte words at TRANBUFF(tx) in response to OP_GETTXS.
+ * Each is read with pread() as it is sent.
+ * Called by child.  Returns VEOK on success, else VERROR.
+ */
+int send_txs(NODE *np)
+{
+   BTRAILER bt;
+   TXQENTRY txe;
+   word32 idx[TRANLEN / 4];
+   word32 n, j, count;
+   byte *ip;
+   int fd, len;
+   char fname[128];
+
+   show("sendtxs");
+   sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(np->tx.blocknum));
+   if(readtrailer(&bt, fname) != VEOK) goto nack;
+   n = get32(bt.tcount);
+   len = get16(np->tx.len);
+   if(len > TRANLEN || (len % 4) != 0) goto nack;
+   /* check the indexes before the stream starts */
+   for(count = 0, ip = TRANBUFF(&np->tx); len > 0; ip += 4, len -= 4) {
+      idx[count] = get32(ip);
+      if(idx[count] >= n) goto nack;
+      count++;
+   }
+   fd = open(fname, O_RDONLY);
+   if(fd == -1) goto nack;
+   send_begin(np);
+   for(j = 0; j < count; j++) {
+      if(pread(fd, &txe, sizeof(TXQENTRY),
+               sizeof(BHEADER) + (long) idx[j] * sizeof(TXQENTRY))
+         != (ssize_t) sizeof(TXQENTRY)
+         || send_add(np, &txe, sizeof(TXQENTRY)) != VEOK) {
+         close(fd);  /* peer sees a short stream */
+         return VERROR;
+      }
+   }
+   close(fd);
+   return send_end(np);
+nack:
+   sendnack(np);
    return VERROR;
-}  /* end send_file() */
+}  /* end send_txs() */
 
 
 /* Send our recent peer list to NODE np in response to OP_GETIPL.
@@ -128,22 +441,14 @@ int identify(NODE *np)
 
 
 /* Called from execute() in execute.c
+ * The miner never writes miner.tmp: it writes the solved block to
+ * miner.sol, so the open file stays whole.
  * Returns 0.
  */
 int send_cblock(NODE *np)
 {
-   char cmd[100], fname[32];
-   pid_t pid;
-
    show("sendcb");
-   if(exists("miner.tmp")) {
-      pid = getpid();
-      sprintf(fname, "cb%u.tmp", (int) pid);
-      sprintf(cmd, "cp miner.tmp %s", fname);
-      system(cmd);
-      send_file(np, fname);
-      unlink(fname);
-   }
+   if(exists("miner.tmp")) send_file(np, "miner.tmp");
    return 0;
 }  /* end send_cblock() */
 
@@ -236,6 +541,9 @@ int execute(NODE *np)
           * Blockfound was set by gettx()
           */
          closesocket(np->sd);  /* close initial connection */
+         /* rebuild it from our TX queues if she can send it compact */
+         if((np->cbits & C_OPX) && get_compact(np->src_ip, np->tx.cblock,
+                                     "rblock.dat") == VEOK) return 0;
          if(get_block2(np->src_ip, np->tx.cblock, "rblock.dat",
                        OP_GETBLOCK) != VEOK) return 1;  /* fail */
          return 0;
@@ -244,6 +552,31 @@ int execute(NODE *np)
          if(send_file(np, NULL) != VEOK) status = 1;
          closesocket(np->sd);
          return status;
+      case OP_GETBLOCKS:
+         /* send a run of blocks to peer */
+         if(send_blocks(np) != VEOK) status = 1;
+         closesocket(np->sd);
+         return status;
+      case OP_GET_RANGE:
+         /* resume a block or tfile.dat download */
+         if(send_range(np) != VEOK) status = 1;
+         closesocket(np->sd);
+         return status;
+      case OP_GETCOMPACT:
+         /* send a block with only the tx_id's of its TX's */
+         if(send_compact(np) != VEOK) status = 1;
+         closesocket(np->sd);
+         return status;
+      case OP_GETTXS:
+         /* send the TX's missing from a compact block */
+         if(send_txs(np) != VEOK) status = 1;
+         closesocket(np->sd);
+         return status;
+      case OP_BALANCES:
+         /* look up many addresses and tags */
+         if(send_balances(np) != VEOK) status = 1;
+         closesocket(np->sd);
+         return status;
       case OP_GET_TFILE:
          /* send out tfile.dat to peer */
          if(send_file(np, "tfile.dat") != VEOK) status = 1;
@@ -32,13 +32,15 @@ int freeslot(NODE *np)
 
 
 /* Send packet: set advertised fields and crc16.
+ * If the peer has C_VLEN, only the header, tx_paylen() bytes of
+ * the transaction buffer, and the crc16 and trailer are sent.
  * Returns VEOK on success, else VERROR.
  */
 int sendtx(NODE *np)
 {
-   int count, len;
-   time_t timeout;
-   byte *buff;
+   int count, len, n;
+   word32 deadline;
+   byte *buff, *tail, save[4];
 
    np->tx.version[0] = PVERSION;
    np->tx.version[1] = Cbits;
@@ -52,26 +54,44 @@ int sendtx(NODE *np)
    memcpy(np->tx.pblockhash, Prevhash, HASHLEN);
    if(get16(np->tx.opcode) != OP_TX)  /* do not copy over TX ip map */
       memcpy(np->tx.weight, Weight, HASHLEN);
-   crctx(&np->tx);
-   count = send(np->sd, TXBUFF(&np->tx), TXBUFFLEN, 0);
-   if(count == TXBUFFLEN) return VEOK;
+
+   n = TRANLEN;
+   if(isvlen(np->cbits, get16(np->tx.opcode)))
+      n = tx_paylen(&np->tx);
+   put16(CRC_VAL_PTR(&np->tx), crc16(CRC_BUFF(&np->tx), TXHDRLEN + n));
+   /* short packet: crc16 and trailer follow the payload on the wire */
+   tail = TRANBUFF(&np->tx) + n;
+   if(n < TRANLEN) {
+      memcpy(save, tail, 4);
+      memcpy(tail, np->tx.crc16, 4);
+   }
+   len = TXHDRLEN + n + 4;
+   buff = TXBUFF(&np->tx);
+   count = send(np->sd, buff, len, 0);
+   if(count == len) goto done;
    /* --- v20 retry */
    if(Trace) plog("sendtx(): send() retry...");
-   timeout = time(NULL) + 10;
-   for(len = TXBUFFLEN, buff = TXBUFF(&np->tx); ; ) {
+   deadline = mtime() + 10000;
+   for( ; ; ) {
       if(count == 0) break;
       if(count > 0) { buff += count; len -= count; }
       else {
-         if(errno != EWOULDBLOCK || time(NULL) >= timeout) break;
+         if(errno != EWOULDBLOCK) break;
+         /* sleep until there is room to send or the deadline */
+         if(waitsock(np->sd, POLLOUT, deadline) != 1) break;
       }
       count = send(np->sd, buff, len, 0);
-      if(count == len) return VEOK;
+      if(count == len) goto done;
    }
    /* --- v20 end */
+   if(n < TRANLEN) memcpy(tail, save, 4);
    Nsenderr++;
    if(Trace)
       plog("send() error: count = %d  errno = %d", count, errno);
    return VERROR;
+done:
+   if(n < TRANLEN) memcpy(tail, save, 4);
+   return VEOK;
 }  /* end sendtx() */
 
 
@@ -118,6 +138,7 @@ int bval2(char *fname, byte *bnum, byte diff)
    }
 
    /* Solution Check */
+   if(pow_cached(&bt, 0) == VEOK) goto good;
    if(cmp64(bnum, v24trigger) > 0) { /* v2.4 Algo */
       if(peach(&bt, get32(bt.difficulty), NULL, 1)) {
          if(Trace) plog("bval2() peach() (VEBAD)");
@@ -130,34 +151,158 @@ int bval2(char *fname, byte *bnum, byte diff)
          return VEBAD;
       }
    }
+   pow_cache(&bt, 0);  /* for bval */
+good:
    if(Trace) plog("bval2() returns VEOK");
    return VEOK;
 }  /* end bval2() */
 
 
+/* Check ahead of update() what in block fname does not depend on the
+ * ledger: the work with bval2(), then the block hash and every WOTS
+ * signature.  A good block is marked in powcache.dat so that bval
+ * does not check them again.
+ * Returns VEOK if good, VEBAD if bad, else VERROR.
+ */
+int preval(char *fname, byte *bnum)
+{
+   static BHEADER bh;
+   static BTRAILER bt;
+   static TXQENTRY tx, txs;
+   static SHA256_CTX bctx;
+   static byte message[HASHLEN], pk2[TXSIGLEN], rnd2[32], bhash[HASHLEN];
+   FILE *fp;
+   word32 hdrlen, tcount, j;
+   long blocklen;
+   MTX *mtx;
+   int status;
+
+   if(readtrailer(&bt, fname) != VEOK) return VERROR;
+   fp = fopen(fname, "rb");
+   if(fp == NULL) return VERROR;
+   status = VERROR;
+   if(fread(&hdrlen, 1, 4, fp) != 4) goto done;
+   if(hdrlen == 4) {  /* pseudo-block: pval() checks it */
+      status = VEOK;
+      goto done;
+   }
+   status = bval2(fname, bnum, bt.difficulty[0]);
+   if(status != VEOK) goto done;
+   status = VEBAD;
+   if(hdrlen != sizeof(BHEADER)) goto done;
+   if(fseek(fp, 0, SEEK_END) != 0 || (blocklen = ftell(fp)) < 0
+      || fseek(fp, 0, SEEK_SET) != 0
+      || fread(&bh, 1, hdrlen, fp) != hdrlen) {
+      status = VERROR;
+      goto done;
+   }
+   tcount = get32(bt.tcount);
+   if(tcount == 0 || tcount > MAXBLTX) goto done;
+   if((hdrlen + sizeof(BTRAILER) + (tcount * sizeof(TXQENTRY)))
+      != (size_t) blocklen) goto done;
+
+   sha256_init(&bctx);
+   sha256_update(&bctx, (byte *) &bh, hdrlen);
+   for(j = 0; j < tcount; j++) {
+      if(fread(&tx, 1, sizeof(TXQENTRY), fp) != sizeof(TXQENTRY)) {
+         status = VERROR;
+         goto done;
+      }
+      sha256_update(&bctx, (byte *) &tx, sizeof(TXQENTRY));
+      /* as bval signs them, with Cblocknum one less than bnum */
+      if(ismtx(&tx) && get32(bnum) - 1 >= MTXTRIGGER) {
+         memcpy(&txs, &tx, sizeof(txs));
+         mtx = (MTX *) &txs;
+         memset(mtx->zeros, 0, NR_DZEROS);
+         sha256(txs.src_addr, SIG_HASH_COUNT, message);
+      } else {
+         sha256(tx.src_addr, SIG_HASH_COUNT, message);
+      }
+      memcpy(rnd2, &tx.src_addr[TXSIGLEN+32], 32);
+      wots_pk_from_sig(pk2, tx.tx_sig, message, &tx.src_addr[TXSIGLEN],
+                       (word32 *) rnd2);
+      if(memcmp(pk2, tx.src_addr, TXSIGLEN) != 0) {
+         if(Trace) plog("preval(): bad signature in 0x%s", bnum2hex(bnum));
+         goto done;
+      }
+   }  /* end for j */
+   sha256_update(&bctx, (byte *) &bt, sizeof(BTRAILER) - HASHLEN);
+   sha256_final(&bctx, bhash);
+   if(memcmp(bt.bhash, bhash, HASHLEN) != 0) goto done;
+   pow_cache(&bt, 1);  /* for bval */
+   status = VEOK;
+done:
+   fclose(fp);
+   if(Trace) plog("preval(0x%s) returns %d", bnum2hex(bnum), status);
+   return status;
+}  /* end preval() */
+
+
+/* Start a child that runs preval() on block bnum in file fname.
+ * Returns the child's pid, or 0 if fork() failed.
+ */
+pid_t preval_fork(char *fname, byte *bnum)
+{
+   pid_t pid;
+
+   pid = fork();
+   if(pid < 0) { error("preval_fork(): cannot fork()"); return 0; }
+   if(pid) return pid;
+   /* in child */
+   signal(SIGTERM, SIG_DFL);  /* preval_end() may kill us */
+   exit(preval(fname, bnum));
+}  /* end preval_fork() */
+
+
+/* Stop the preval_fork() children in pid[count]. */
+void preval_end(pid_t *pid, int count)
+{
+   int j;
+
+   for(j = 0; j < count; j++) {
+      if(pid[j] <= 0) continue;
+      kill(pid[j], SIGTERM);
+      waitpid(pid[j], NULL, 0);
+      pid[j] = 0;
+   }
+}  /* end preval_end() */
+
+
 /* Catch up by getting blocks: all else waits...
+ * A fetch_blocks() child streams the blocks while we validate
+ * and update() the ones that have already arrived.
  * Returns VEOK if updates made, VEBAD if peer is Evil, else VERROR.
  */
 int catchup(word32 peerip)
 {
    byte bnum[8];
+   char fname[64];
+   FETCH fe;
    int count, status;
 
    if(Trace) plog("catchup(%s)", ntoa((byte *) &peerip));
 
    put64(bnum, Cblocknum);
+   add64(bnum, One, bnum);
+   if(bnum[0] == 0) add64(bnum, One, bnum);  /* do not fetch NG blocks */
+   if(fetch_blocks(&fe, peerip, bnum) != VEOK) return VERROR;
    for(count = 0; Running; ) {
-      add64(bnum, One, bnum);
-      if(bnum[0] == 0) continue;  /* do not fetch NG blocks */
-      if(get_block2(peerip, bnum, "rblock.dat", OP_GETBLOCK) != VEOK) break;
-      status = bval2("rblock.dat", bnum, Difficulty);
+      if(fetch_wait(&fe, bnum, fname) != VEOK) break;
+      status = bval2(fname, bnum, Difficulty);
       if(status != VEOK) {
-         if(status == VEBAD) { epinklist(peerip); goto done; }
+         if(status == VEBAD) {
+            epinklist(peerip);
+            fetch_end(&fe, bnum);
+            goto done;
+         }
          break;
       }
-      if(update("rblock.dat", 0) != VEOK) break;
+      if(update(fname, 0) != VEOK) break;
       count++;
+      add64(bnum, One, bnum);
+      if(bnum[0] == 0) add64(bnum, One, bnum);
    }  /* end for count */
+   fetch_end(&fe, bnum);
    status = VEOK;
    if(count == 0) status = VERROR;  /* no updates made */
 done:
@@ -223,6 +368,37 @@ done:
 }  /* end contention() */
 
 
+/* Look up tx_id in the recent TX table, Txseen[].
+ * If add is non-zero and it is not there, put it in an empty or the
+ * oldest slot near its hash.
+ * Return VERROR if tx_id was seen in the last TXSEENTIME seconds,
+ * else VEOK.
+ */
+int txseen(byte *tx_id, int add)
+{
+   TXSEEN *tp, *old;
+   word32 j, h;
+   time_t now;
+
+   now = time(NULL);
+   h = get32(tx_id) % CRCLISTLEN;  /* tx_id is a hash */
+   for(old = NULL, j = 0; j < TXSEENPROBE; j++) {
+      tp = &Txseen[(h + j) % CRCLISTLEN];
+      if(tp->time && memcmp(tp->tx_id, tx_id, HASHLEN) == 0) {
+         if(now - tp->time < TXSEENTIME) return VERROR;
+         old = tp;  /* expired: renew below */
+         break;
+      }
+      if(old == NULL || tp->time < old->time) old = tp;
+   }
+   if(add) {
+      memcpy(old->tx_id, tx_id, HASHLEN);
+      old->time = now;
+   }
+   return VEOK;
+}  /* end txseen() */
+
+
 /* Search txq1.dat and txclean.dat for src_addr.
  * Return VEOK if the src_addr is not found, otherwise VERROR.
  */
@@ -265,85 +441,136 @@ int txcheck(byte *src_addr)
 
 /**
  * Listen gettx()   (still in parent)
- * Reads a TX structure from SOCKET sd.  Handles 3-way and 
- * validates crc and id's.  Also cares for requests that do not need
- * a child process.
+ * Reads a TX structure from the socket of Pending[] slot pp, as it
+ * arrives, so that no slot holds up the others.  Handles 3-way and
+ * validates crc and id's.  The request is then served by dispatch()
+ * in order of its class.
  *
  * Returns:
- *          -1 no data yet
- *          0 connection reset
- *          sizeof(TX) to create child NODE to process read np->tx
+ *          -1 no data yet (call again)
+ *          sizeof(TX) request in pp->node.tx is ready for dispatch()
  *          1 to close connection ("You're done, tx")
  *          2 src_ip was pinklisted (She was very naughty.)
  *
- * On entry: sd is non-blocking.
+ * On entry: pp->node.sd is non-blocking, and pp->step is zero
+ * for a new connection.
  *
  * Op sequence: OP_HELLO,OP_HELLO_ACK,OP_(?x)
  */
-int gettx(NODE *np, SOCKET sd)
+int gettx(PENDING *pp)
 {
-   int count, status, n;
+   int status;
    word16 opcode;
+   NODE *np;
    TX *tx;
-   word32 ip;
-   time_t timeout;
+   SOCKET sd;
 
+   np = &pp->node;
    tx = &np->tx;
-   memset(np, 0, sizeof(NODE));  /* clear structure */
-   np->sd = sd;
-   np->src_ip = ip = getsocketip(sd);  /* uses getpeername() */
-
-   /*
-    * There are many ways to be bad...
-    * Check pink lists...
-    */
-   if(pinklisted(ip)) {
-      Nbadlogs++;
-      return 2;
-   }
-
-   n = recv(sd, TXBUFF(tx), TXBUFFLEN, 0);
-   if(n <= 0) return n;
-   timeout = time(NULL) + 3;
-   for( ; n != TXBUFFLEN; ) {
-      count = recv(sd, TXBUFF(tx) + n, TXBUFFLEN - n, 0);
-      if(count == 0) return 1;
-      if(count < 0) {
-         if(time(NULL) >= timeout) { Ntimeouts++; return 1; }
-         continue;
+   if(pp->step == 0) {
+      sd = np->sd;
+      memset(np, 0, sizeof(NODE));  /* clear structure */
+      np->sd = sd;
+      np->src_ip = getsocketip(sd);  /* uses getpeername() */
+      /*
+       * There are many ways to be bad...
+       * Check pink lists...
+       */
+      if(pinklisted(np->src_ip)) {
+         Nbadlogs++;
+         return 2;
       }
-      n += count;  /* collect the full TX */
+      pp->step = 1;  /* wait for OP_HELLO */
+      pp->got = 0;
    }
-   count = n;
 
-   /*
-    * validate packet and return 1 if bad.
-    */
+   /* step 2 waits for the request after OP_HELLO_ACK */
+   status = rx_nowait(np, &pp->got, pp->step == 2);
+   if(status == VETIMEOUT) return -1;
    opcode = get16(tx->opcode);
-   if(get16(tx->network) != TXNETWORK
-      || get16(tx->trailer) != TXEOT
-      || crc16(CRC_BUFF(tx), CRC_COUNT) != get16(tx->crc16) ) {
-            if(Trace) plog("gettx(): bad packet");
-            return 1;  /* BAD packet */
-   }
-   if(tx->version[0] != PVERSION) {
-      if(Trace) plog("gettx(): bad version");
-      return 1;
+   if(pp->step == 1) {
+      /*
+       * validate packet and return 1 if bad.
+       */
+      if(status != VEOK) {
+         if(Trace) plog("gettx(): bad packet");
+         return 1;  /* BAD packet */
+      }
+      if(tx->version[0] != PVERSION) {
+         if(Trace) plog("gettx(): bad version");
+         return 1;
+      }
+      if(Trace) plog("gettx(): crc16 good");
+      if(opcode != OP_HELLO) goto bad1;
+      np->cbits = tx->version[1];
+      np->id1 = get16(tx->id1);
+      np->id2 = rand16();
+      if(send_op(np, OP_HELLO_ACK) != VEOK) return VERROR;
+      pp->step = 2;
+      pp->got = 0;
+      return -1;
    }
-   
-   if(Trace) plog("gettx(): crc16 good");
-   if(opcode != OP_HELLO) goto bad1;
-   np->id1 = get16(tx->id1);
-   np->id2 = rand16();
-   if(send_op(np, OP_HELLO_ACK) != VEOK) return VERROR;
-   status = rx2(np, 1, 3);
-   opcode = get16(tx->opcode);
+
    if(Trace)
       plog("gettx(): got opcode = %d  status = %d", opcode, status);
    if(status == VEBAD) goto bad2;
-   if(status != VEOK) return VERROR;  /* bad packet -- timeout? */
+   if(status != VEOK) return VERROR;  /* bad packet */
    np->opcode = opcode;  /* execute() will check the opcode */
+   if(opcode > LAST_OP && opcode <= MAX_OP) {
+      sendnack(np);  /* a newer peer can take no for an answer */
+      return 1;
+   }
    if(!valid_op(opcode)) goto bad1;  /* she was a bad girl */
+   return sizeof(TX);  /* server() queues np for dispatch() */
+
+bad1: epinklist(np->src_ip);
+bad2: pinklist(np->src_ip);
+      Nbadlogs++;
+      if(Trace)
+         plog("   gettx(): pinklist(%s) opcode = %d",
+              ntoa((byte *) &np->src_ip), opcode);
+   return 2;
+}  /* end gettx() */
+
+
+/* Class of a request read by gettx(), for the order of dispatch().
+ * A found block comes first, then serving sync and relay of TX,
+ * then wallet queries.
+ */
+int op_class(int opcode)
+{
+   switch(opcode) {
+      case OP_FOUND:
+         return PRI_FOUND;
+      case OP_GETIPL:
+      case OP_BALANCE:
+      case OP_BALANCES:
+      case OP_RESOLVE:
+      case OP_IDENTIFY:
+         return PRI_QUERY;
+   }
+   return PRI_SYNC;
+}
+
+
+/**
+ * Serve the request read by gettx()   (still in parent)
+ * Cares for requests that do not need a child process.
+ *
+ * Returns:
+ *          sizeof(TX) to create child NODE to process read np->tx
+ *          1 to close connection ("You're done, tx")
+ *          2 src_ip was pinklisted
+ */
+int dispatch(NODE *np)
+{
+   int status;
+   word16 opcode;
+   TX *tx;
+   byte tx_id[HASHLEN];
+
+   tx = &np->tx;
+   opcode = np->opcode;
 
    if(opcode == OP_GETIPL) {
       send_ipl(np);
@@ -354,8 +581,23 @@ int gettx(NODE *np, SOCKET sd)
       return 1;  /* You're done! */
    }
    else if(opcode == OP_TX) {
+      /* drop a copy of a recent TX before any other work */
+      sha256(tx->src_addr, TXADDRLEN, tx_id);
+      if(txseen(tx_id, 0) != VEOK) {
+         if(Trace > 1) plog("got recent TX");
+         Ndups++;
+         return 1;
+      }
+      /* refuse a flood before the costly signature check */
+      if(tx_admit(np->src_ip) != VEOK) {
+         if(Trace) plog("OP_TX rate limited");
+         Nlimited++;
+         sendnack(np);
+         return 1;
+      }
       if(txcheck(tx->src_addr) != VEOK) {
          if(Trace) plog("got dup src_addr");
+         txseen(tx_id, 1);
          Ndups++;
          return 1;  /* suppress child */
       }
@@ -363,6 +605,7 @@ int gettx(NODE *np, SOCKET sd)
       status = process_tx(np);
       if(status > 2) goto bad1;
       if(status > 1) goto bad2;
+      if(status == 0) txseen(tx_id, 1);
       if(get16(np->tx.len) == 0) {  /* do not add wallets */
          addcurrent(np->src_ip);    /* add to peer lists */
          addrecent(np->src_ip);
@@ -392,11 +635,11 @@ int gettx(NODE *np, SOCKET sd)
       /* fork() child in sever() */
       /* end if OP_FOUND */
    } else if(opcode == OP_BALANCE) {
-      send_balance(np);
+      if(query_pass(np) != VEOK) send_balance(np);
       Nsent++;
       return 1;  /* no child */
    } else if(opcode == OP_RESOLVE) {
-      tag_resolve(np);
+      if(query_pass(np) != VEOK) tag_resolve(np);
       return 1;
    } else if(opcode == OP_GET_CBLOCK) {
       if(!Allowpush || !exists("miner.tmp")) return 1;
@@ -415,16 +658,16 @@ int gettx(NODE *np, SOCKET sd)
       return 1;  /* no child needed */
    /* If too many children in too small a space... */
    if(crowded(opcode)) return 1;  /* suppress child unless OP_FOUND */
-   return count;  /* success -- fork() child in server() */
+   return sizeof(TX);  /* success -- fork() child in server() */
 
 bad1: epinklist(np->src_ip);
 bad2: pinklist(np->src_ip);
       Nbadlogs++;
       if(Trace)
-         plog("   gettx(): pinklist(%s) opcode = %d",
+         plog("   dispatch(): pinklist(%s) opcode = %d",
               ntoa((byte *) &np->src_ip), opcode);
    return 2;
-}  /* end gettx() */
+}  /* end dispatch() */
 
 
 /**
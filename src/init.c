@@ -7,6 +7,8 @@
  *
 */
 
+#include <sys/mman.h>
+
 int hex2bnum(byte *bnum, char *hex)
 {
    byte *bp;
@@ -131,33 +133,110 @@ int read_localipl(char *fname) {
 }
 
 
+/* Call addrecent() on the ip list in tx.
+ * Return VEOK, or VEBAD if the list is too long.
+ */
+int add_ipl(TX *tx)
+{
+   int len;
+   word32 *ipp;
+
+   len = get16(tx->len);
+   if((unsigned) len > TRANLEN) return VEBAD;
+   for(ipp = (word32 *) TRANBUFF(tx); len > 0; ipp++, len -= 4) {
+      if(*ipp) {
+         if(Trace) plog("adding 0x%x from TX to recent", *ipp);
+         addrecent(*ipp);
+      }
+   }
+   return VEOK;
+}  /* end add_ipl() */
+
+
 /* Get an ip list from ip and copy it into np,
  * also call addrecent() on the list.
  * Return VEOK if successful, else error code.
 */
 int get_ipl(NODE *np, word32 ip)
 {
-   int len;
-   word32 *ipp;
-
    if(Trace)
       plog("get_ipl() about to call get_tx2()");
-   if(get_tx2(np, ip, OP_GETIPL) == VEOK) {  /* closes socket */
-      len = get16(np->tx.len);
-      if((unsigned) len > TRANLEN) return VEBAD;
-      for(ipp = (word32 *) TRANBUFF(&np->tx); len > 0;
-             ipp++, len -= 4) {
-                if(*ipp) {
-                   if(Trace) plog("adding 0x%x from TX to recent", *ipp);
-                   addrecent(*ipp);
-                }
-      }
-      return VEOK;
-   }
+   if(get_tx2(np, ip, OP_GETIPL) == VEOK)  /* closes socket */
+      return add_ipl(&np->tx);
    return VERROR;
 }  /* end get_ipl() */
 
 
+/* Ask up to IPLPROBES peers in list[count] for their ip lists at once.
+ * Each child has IPLPEERTIME seconds to get an answer, and all of them
+ * IPLWAIT seconds, or until want peers have answered.  The answers are
+ * copied to tx[] and their peers to ip[], fastest first, and each list
+ * is given to addrecent().
+ * Returns the number of answers.
+ */
+int get_ipls(word32 *list, int count, int want, TX *tx, word32 *ip)
+{
+   NODE node;
+   TX *answer;
+   word32 peer[IPLPROBES];
+   pid_t pid[IPLPROBES];
+   int j, n, left, status;
+   time_t deadline;
+
+   if(count > IPLPROBES) count = IPLPROBES;
+   if(count < 1 || want < 1) return 0;
+   memcpy(peer, list, count * sizeof(word32));  /* addrecent() may move */
+   answer = mmap(NULL, count * sizeof(TX), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if(answer == MAP_FAILED) {
+      error("get_ipls(): cannot map answers");
+      return 0;
+   }
+   for(j = 0; j < count; j++) {
+      pid[j] = 0;
+      if(peer[j] == 0) continue;
+      pid[j] = fork();
+      if(pid[j] == 0) {
+         signal(SIGTERM, SIG_DFL);
+         signal(SIGALRM, SIG_DFL);  /* per peer deadline */
+         alarm(IPLPEERTIME);
+         if(get_tx2(&node, peer[j], OP_GETIPL) != VEOK) _exit(VERROR);
+         memcpy(&answer[j], &node.tx, sizeof(TX));
+         _exit(VEOK);
+      }
+      if(pid[j] < 0) pid[j] = 0;
+   }
+
+   /* collect answers in the order they arrive */
+   deadline = time(NULL) + IPLWAIT;
+   for(n = 0; Running && n < want; ) {
+      for(left = j = 0; j < count && n < want; j++) {
+         if(pid[j] == 0) continue;
+         if(waitpid(pid[j], &status, WNOHANG) != pid[j]) {
+            left++;
+            continue;
+         }
+         pid[j] = 0;
+         if(WIFSIGNALED(status)) peer_fail(peer[j]);  /* out of time */
+         if(!WIFEXITED(status) || WEXITSTATUS(status) != VEOK) continue;
+         if(add_ipl(&answer[j]) != VEOK) continue;
+         memcpy(&tx[n], &answer[j], sizeof(TX));
+         ip[n++] = peer[j];
+      }
+      if(left == 0 || time(NULL) >= deadline) break;
+      usleep(10000);
+   }
+   for(j = 0; j < count; j++) {
+      if(pid[j] == 0) continue;
+      kill(pid[j], SIGTERM);
+      waitpid(pid[j], NULL, 0);
+   }
+   munmap(answer, count * sizeof(TX));
+   if(Trace) plog("get_ipls(): %d of %d answered", n, count);
+   return n;
+}  /* end get_ipls() */
+
+
 /* On server INIT rplist.lst is on disk
  * otherwise check for coreip.lst and read into Coreplist.
  * Peer's cblock number is returned in np->cblock and
@@ -192,15 +271,16 @@ word32 init_coreipl(NODE *np, char *fname)
    }
 
    /*
-    * Get a recent peer list.
+    * Get a recent peer list from the first to answer,
+    * asking the best scored peers first.
     */
+   memcpy(rplist, Rplist, sizeof(rplist));
+   peer_sort(rplist, RPLISTLEN);  /* Rplist keeps its order */
    return_ip = 0;
-   for(j = 0 ; j < RPLISTLEN; j++) {
-      ip = Rplist[j];  /* select random peer */
-      if(ip == 0) continue;
-      if(Trace)
-         plog("init_coreipl() about to call get_ipl(%s)", ntoa((byte *) &ip));
-      if(get_ipl(np, ip) != VEOK) continue;
+   for(j = 0 ; j < RPLISTLEN && Running; j += IPLPROBES) {
+      if(Trace) plog("init_coreipl() about to call get_ipls(%d)", j);
+      if(get_ipls(&rplist[j], RPLISTLEN - j, 1, &np->tx, &ip) == 0)
+         continue;
       return_ip = ip;
       break;
    }  /* end for */
@@ -212,6 +292,8 @@ word32 init_coreipl(NODE *np, char *fname)
 
 /* Extract the ledger from a neo-genesis block and
  * put it in ledger file lfile (ledger.dat)
+ * It is written to lfile.tmp and renamed into place whole,
+ * since query workers may map lfile at any time.
  * Return VEOK on success, else VERROR.
  */
 int extract(char *fname, char *lfile)
@@ -221,17 +303,19 @@ int extract(char *fname, char *lfile)
    LENTRY le;        /* buffer to read ledger entry */
    byte prevaddr[TXADDRLEN];  /* to check block addr sort */
    byte first;
+   char tname[128];
 
    if(Trace) plog("extract() ledger from %s to %s", fname, lfile);
+   sprintf(tname, "%.100s.tmp", lfile);
 
    /* open the neo-genesis block and read in file header length */
    fp = fopen(fname, "rb");
    if(!fp) return VERROR;;
    if(fread(&hdrlen, 1, 4, fp) != 4) goto ioerror;
 
-   lfp = fopen(lfile, "wb");
+   lfp = fopen(tname, "wb");
    if(!lfp) {
-      error("extract(): Cannot open %s", lfile);
+      error("extract(): Cannot open %s", tname);
       goto ioerror;
    }
 
@@ -267,11 +351,14 @@ int extract(char *fname, char *lfile)
       goto error2;
    }
    fclose(fp);
-   fclose(lfp);
+   if(fclose(lfp) != 0 || rename(tname, lfile) != 0) {
+      unlink(tname);
+      return error("extract(): cannot write %s", lfile);
+   }
    return VEOK;
 ioerror:
       fclose(fp);
-      unlink(lfile);  /* remove bad ledger */
+      unlink(tname);  /* remove bad ledger */
       return error("extract() failed!");
 error2:
    fclose(lfp);
@@ -332,65 +419,44 @@ void resign(char *mess)
 }
 
 
-/* Validate a tfile
- * Returns: a pointer to static weight.
- *          *result is set to 0 on success with the block number
- *          of last good tfile record is left in highblock,
- *          otherwise *result is set to non-zero error code.
- *
- * Error codes 1-10 are validation errors; codes >= 100 are I/O, 
- * codes >= 200 are (errno + 200).
+/* Set *tsp to the state before the Genesis Block trailer.
+ * Returns VEOK on success, else VERROR.
  */
-byte *tfval(char *fname, byte *highblock, int weight_only, int *result)
+int tfinit(TFSTATE *tsp)
 {
-   FILE *fp;
    BTRAILER bt;
-   word32 difficulty = 0;
-   word32 time1 = 0;
-   word32 stime;
-   byte prevhash[HASHLEN];
-   static byte weight[HASHLEN];   /* return value */
-   long filelen;
-   int ecode, gblock;
    char genfile[100];
-   word32 now;
-   word32 tcount;
-   static word32 tottrigger[2] = { V23TRIGGER, 0 };
-   static word32 v24trigger[2] = { V24TRIGGER, 0 };
-
-   *result = 100;                 /* I/O high error code */
-   memset(highblock, 0, 8);       /* start from genesis block */
-   memset(weight, 0, HASHLEN);
-
-   if(Trace) plog("Entering tfval()");
-   show("tfval");
 
+   memset(tsp, 0, sizeof(TFSTATE));
    sprintf(genfile, "%s/b0000000000000000.bc", Bcdir);
    /* get trailer from our Genesis Block */
-   if(readtrailer(&bt, genfile) != VEOK) return weight;  /* error 100 */
-   memcpy(prevhash, bt.bhash, HASHLEN);
+   if(readtrailer(&bt, genfile) != VEOK) return VERROR;
+   memcpy(tsp->prevhash, bt.bhash, HASHLEN);
+   return VEOK;
+}  /* end tfinit() */
 
-   fp = fopen(fname, "rb");
-   if(!fp) {
-      error("tfval(): Cannot open %s", fname);
-      *result = 101;
-      return weight;
-   }
 
-   fseek(fp, 0, SEEK_END);
-   filelen = ftell(fp);
-   if((filelen % sizeof(BTRAILER)) != 0) {
-      fclose(fp);
-      *result = 102;
-      return weight;
-   }
-   fseek(fp, 0, SEEK_SET);
+/* The serial checks of tfval2(), with the proof of work of trailer
+ * index badpow taken as bad.  *np is set to the number of trailers
+ * that passed.
+ * Returns 0 on success, else validation error code 1-10.
+ */
+int tfserial(FILE *fp, TFSTATE *tsp, word32 count, int weight_only,
+             word32 badpow, word32 *np)
+{
+   BTRAILER bt;
+   word32 stime;
+   word32 now, n;
+   word32 tcount;
+   int ecode;
+   static word32 tottrigger[2] = { V23TRIGGER, 0 };
 
    now = time(NULL);
-   /* Validate every block trailer in tfile and compute weight. */
-   for(gblock = 1; ; gblock = 0) {
+   /* Validate each block trailer and compute weight. */
+   for(n = 0; ; n++) {
       if(Monitor && Bgflag == 0) resign("tfile user break");  /* DSL */
       ecode = 0;
+      if(count && n >= count) break;
       if(fread(&bt, 1, sizeof(BTRAILER), fp)
             != sizeof(BTRAILER)) break;  /* EOF */
 
@@ -398,80 +464,159 @@ byte *tfval(char *fname, byte *highblock, int weight_only, int *result)
 
       ecode++;
       /* The Genesis Block is very special. 1 */
-      if(gblock) {
+      if(iszero(tsp->bnum, 8)) {
          if(!iszero(&bt, (sizeof(BTRAILER) - HASHLEN))) break;
          ecode++;  /* 2 */
-         if(memcmp(prevhash, bt.bhash, HASHLEN) != 0) break;
-         difficulty = 1;  /* difficulty of block one. */
+         if(memcmp(tsp->prevhash, bt.bhash, HASHLEN) != 0) break;
+         tsp->difficulty = 1;  /* difficulty of block one. */
          goto next;
       }
       if(weight_only) goto skipval;
 
       ecode = 3;
       /* validate block trailer -- Mfee: 3 */
-      if(highblock[0] && tcount) {
+      if(tsp->bnum[0] && tcount) {
          if(cmp64(bt.mfee, Mfee) < 0) break;
       } else if(!iszero(bt.mfee, 8)) break;  /* for NG block or P-block */
 
       ecode++;  /* difficulty ecode = 4 */
-      if(get32(bt.difficulty) != difficulty) break;
+      if(get32(bt.difficulty) != tsp->difficulty) break;
 
       ecode++;
       /* check for early block time 5 */
       stime = get32(bt.stime);
-      if(highblock[0]) {
-         if(stime <= time1) break;  /* unsigned time here */
+      if(tsp->bnum[0]) {
+         if(stime <= tsp->time1) break;  /* unsigned time here */
          ecode++;  /* future block time 6 */
          if(stime > now && (stime - now) > BCONFREQ) break;
       }
-      else if(stime != time1) break;  /* bad time for NG block */
+      else if(stime != tsp->time1) break;  /* bad time for NG block */
       ecode = 7;
       /* bad block number 7 */
-      if(cmp64(highblock, bt.bnum) != 0) break;
+      if(cmp64(tsp->bnum, bt.bnum) != 0) break;
       ecode++;
       /* bad previous hash 8 */
-      if(memcmp(prevhash, bt.phash, HASHLEN) != 0) break;
+      if(memcmp(tsp->prevhash, bt.phash, HASHLEN) != 0) break;
       ecode++;
+      /* off the chain of a checkpoint 9 */
+      if(!Tfcheckall && checkpt_bad(&bt)) break;
       /* check enforced delay 9 */
-      if(highblock[0] && tcount && get32(Cblocknum) >= Trustblock) {
-         if(cmp64(bt.bnum, v24trigger) > 0) { /* v2.4 */
-            if(peach(&bt, get32(bt.difficulty), NULL, 1)){
-            break;
-            }
-         }
-         if(cmp64(bt.bnum, v24trigger) <= 0) { /* v2.3 and prior */ 
-            if(trigg_check(bt.mroot, bt.difficulty[0], bt.bnum) == NULL) {
-            break;
-            }
-         }
+      if(tsp->bnum[0] && tcount && get32(Cblocknum) >= Trustblock) {
+         if(n == badpow) break;  /* see pow_val() */
       }
       ecode = 10;
-      if(cmp64(highblock, tottrigger) > 0 &&
-        (highblock[0] != 0xfe && highblock[0] != 0xff && highblock[0] != 0)) {
+      if(cmp64(tsp->bnum, tottrigger) > 0 &&
+        (tsp->bnum[0] != 0xfe && tsp->bnum[0] != 0xff && tsp->bnum[0] != 0)) {
          if((word32) (stime - get32(bt.time0)) > BRIDGE) break;
       }
 
 skipval:
       /* update for next loop 11 */
-      time1 = get32(bt.stime);
+      tsp->time1 = get32(bt.stime);
       if(Trace) plog("block: 0x%s difficulty: %d  seconds: %d",
-           bnum2hex(bt.bnum), difficulty, time1 - get32(bt.time0));
+           bnum2hex(bt.bnum), tsp->difficulty,
+           tsp->time1 - get32(bt.time0));
       /*
        * Let the neo-genesis (not the 0xff) block change the 
        * difficulty for the next 0x01 block.
        */
-      if(highblock[0] != 0xff) {
-         add_weight(weight, difficulty, bt.bnum);
-         difficulty = set_difficulty(difficulty, time1 - get32(bt.time0),
-                                     time1, bt.bnum);
-         if(Trace) plog("new difficulty: %d", difficulty);
+      if(tsp->bnum[0] != 0xff) {
+         add_weight(tsp->weight, tsp->difficulty, bt.bnum);
+         tsp->difficulty = set_difficulty(tsp->difficulty,
+                                          tsp->time1 - get32(bt.time0),
+                                          tsp->time1, bt.bnum);
+         if(Trace) plog("new difficulty: %d", tsp->difficulty);
       }
 next:
       /* set previous hash for next iteration */
-      memcpy(prevhash, bt.bhash, HASHLEN);
-      add64(highblock, One, highblock);  /* bnum in next trailer */
+      memcpy(tsp->prevhash, bt.bhash, HASHLEN);
+      add64(tsp->bnum, One, tsp->bnum);  /* bnum in next trailer */
    }  /* end for */
-   sub64(highblock, One, highblock);     /* fix high block number */
+   *np = n;
+   return ecode;
+}  /* end tfserial() */
+
+
+/* Validate up to count trailers (zero for to EOF) from fp,
+ * continuing from the state in *tsp, and update *tsp past
+ * each good trailer.  The serial checks come first, and then
+ * pow_first() checks the work of the trailers that passed them
+ * on all cores.
+ * Returns 0 on success, else validation error code 1-10.
+ */
+int tfval2(FILE *fp, TFSTATE *tsp, word32 count, int weight_only)
+{
+   TFSTATE ts;
+   long start;
+   word32 n;
+   word32 badpow;  /* index of first trailer with bad proof of work */
+   word32 skip;    /* trailers up to a checkpoint */
+   int ecode;
+
+   if(weight_only || get32(Cblocknum) < Trustblock)
+      return tfserial(fp, tsp, count, weight_only, 0xffffffff, &n);
+   start = ftell(fp);
+   /* no need to check work up to a checkpoint the file matches */
+   skip = checkpt_skip(fp, get32(tsp->bnum), count);
+   memcpy(&ts, tsp, sizeof(TFSTATE));
+   ecode = tfserial(fp, tsp, count, 0, 0xffffffff, &n);
+   if(n <= skip) return ecode;
+   badpow = skip + pow_first(fileno(fp),
+                             start + (long) skip * sizeof(BTRAILER), n - skip);
+   if(badpow >= n) return ecode;
+   /* go again from the start to stop at the bad work */
+   memcpy(tsp, &ts, sizeof(TFSTATE));
+   if(fseek(fp, start, SEEK_SET) != 0) return 1;
+   return tfserial(fp, tsp, badpow + 1, 0, badpow, &n);
+}  /* end tfval2() */
+
+
+/* Validate a tfile
+ * Returns: a pointer to static weight.
+ *          *result is set to 0 on success with the block number
+ *          of last good tfile record is left in highblock,
+ *          otherwise *result is set to non-zero error code.
+ *
+ * Error codes 1-10 are validation errors; codes >= 100 are I/O, 
+ * codes >= 200 are (errno + 200).
+ */
+byte *tfval(char *fname, byte *highblock, int weight_only, int *result)
+{
+   FILE *fp;
+   TFSTATE ts;
+   static byte weight[HASHLEN];   /* return value */
+   long filelen;
+   int ecode;
+
+   *result = 100;                 /* I/O high error code */
+   memset(highblock, 0, 8);       /* start from genesis block */
+   memset(weight, 0, HASHLEN);
+
+   if(Trace) plog("Entering tfval()");
+   show("tfval");
+
+   if(tfinit(&ts) != VEOK) return weight;  /* error 100 */
+
+   fp = fopen(fname, "rb");
+   if(!fp) {
+      error("tfval(): Cannot open %s", fname);
+      *result = 101;
+      return weight;
+   }
+
+   fseek(fp, 0, SEEK_END);
+   filelen = ftell(fp);
+   if((filelen % sizeof(BTRAILER)) != 0) {
+      fclose(fp);
+      *result = 102;
+      return weight;
+   }
+   fseek(fp, 0, SEEK_SET);
+
+   /* Validate every block trailer in tfile and compute weight. */
+   ecode = tfval2(fp, &ts, 0, weight_only);
+   sub64(ts.bnum, One, highblock);     /* fix high block number */
+   memcpy(weight, ts.weight, HASHLEN);
    fclose(fp);
    if(Trace) plog("tfval(): ecode = %d  bnum = 0x%s  weight = 0x...%x",
                   ecode, bnum2hex(highblock), weight[0]);
@@ -480,6 +625,312 @@ next:
 }  /* end tfval() */
 
 
+/* Add count trailers from fp to the sha256 in *ctx.
+ * Returns VEOK on success, else VERROR.
+ */
+int tfhash_add(FILE *fp, word32 count, SHA256_CTX *ctx)
+{
+   BTRAILER bt[64];
+   word32 n;
+
+   for( ; count > 0; count -= n) {
+      n = count < 64 ? count : 64;
+      if(fread(bt, sizeof(BTRAILER), n, fp) != n) return VERROR;
+      sha256_update(ctx, (byte *) bt, n * sizeof(BTRAILER));
+   }
+   return VEOK;
+}  /* end tfhash_add() */
+
+
+/* Hash the first count trailers of fp into hash.
+ * Returns VEOK on success, else VERROR.
+ */
+int tfhash(FILE *fp, word32 count, byte *hash)
+{
+   SHA256_CTX ctx;
+
+   if(fseek(fp, 0, SEEK_SET) != 0) return VERROR;
+   sha256_init(&ctx);
+   if(tfhash_add(fp, count, &ctx) != VEOK) return VERROR;
+   sha256_final(&ctx, hash);
+   return VEOK;
+}  /* end tfhash() */
+
+
+/* Recent states of tfile validation for tfcheck_save(), newest last.
+ * Each is the state after the first Tfstate[].bnum trailers of
+ * tfile.dat, with the sha256 of those trailers not yet final.
+ */
+TFSTATE Tfstate[TFCHECKS];
+SHA256_CTX Tfctx[TFCHECKS];
+int Ntfstate;
+
+
+/* Keep the state *tsp after the trailers hashed in *ctx. */
+void tfcheck_keep(TFSTATE *tsp, SHA256_CTX *ctx)
+{
+   if(Ntfstate >= TFCHECKS) {
+      /* forget the oldest */
+      memmove(Tfstate, &Tfstate[1], (TFCHECKS - 1) * sizeof(TFSTATE));
+      memmove(Tfctx, &Tfctx[1], (TFCHECKS - 1) * sizeof(SHA256_CTX));
+      Ntfstate = TFCHECKS - 1;
+   }
+   memcpy(&Tfstate[Ntfstate], tsp, sizeof(TFSTATE));
+   memcpy(&Tfctx[Ntfstate], ctx, sizeof(SHA256_CTX));
+   Ntfstate++;
+}
+
+
+/* Save the state after all trailers in tfile.dat to tfile.chk,
+ * so that tfresume() need not check them again.  The newest state
+ * kept by tfresume() or the last save whose trailer is still in
+ * tfile.dat is carried over only the trailers after it.  Trailers
+ * are only added to tfile.dat after they or their blocks are
+ * validated, so those are summed without proof of work.
+ * If no kept state is on tfile.dat any more, all of it is summed
+ * only if rescan is non-zero, since that is a pass over the chain.
+ * Returns VEOK on success, else VERROR.
+ */
+int tfcheck_save(int rescan)
+{
+   FILE *fp;
+   BTRAILER bt;
+   TFCHECK tc;
+   SHA256_CTX ctx;
+   word32 count;
+   int j;
+
+   Tfcheckblock = get32(Cblocknum) + 1;  /* try again in TFCHECKFREQ */
+   if(Trustblock) return VERROR;  /* proof of work was not checked */
+   fp = fopen("tfile.dat", "rb");
+   if(fp == NULL) return VERROR;
+   /* skip states from trailers since undone by syncup() */
+   for(count = 0, j = Ntfstate - 1; j >= 0; j--) {
+      count = get32(Tfstate[j].bnum);
+      if(count == 0) break;
+      if(fseek(fp, (long) (count - 1) * sizeof(BTRAILER), SEEK_SET) == 0
+         && fread(&bt, 1, sizeof(BTRAILER), fp) == sizeof(BTRAILER)
+         && memcmp(bt.bhash, Tfstate[j].prevhash, HASHLEN) == 0) break;
+   }
+   Ntfstate = j + 1;
+   if(j >= 0) {
+      memcpy(&tc.ts, &Tfstate[j], sizeof(TFSTATE));
+      memcpy(&ctx, &Tfctx[j], sizeof(SHA256_CTX));
+   } else {
+      if(!rescan || tfinit(&tc.ts) != VEOK) {
+         fclose(fp);
+         if(Trace) plog("tfcheck_save(): no state on tfile.dat");
+         return VERROR;
+      }
+      count = 0;
+      sha256_init(&ctx);
+   }
+   if(fseek(fp, (long) count * sizeof(BTRAILER), SEEK_SET) != 0
+      || tfval2(fp, &tc.ts, 0, 1) != 0
+      || fseek(fp, (long) count * sizeof(BTRAILER), SEEK_SET) != 0
+      || tfhash_add(fp, get32(tc.ts.bnum) - count, &ctx) != VEOK) {
+      fclose(fp);
+      return error("tfcheck_save(): bad tfile.dat");
+   }
+   fclose(fp);
+   if(get32(tc.ts.bnum) > count) tfcheck_keep(&tc.ts, &ctx);
+   sha256_final(&ctx, tc.tfhash);
+   sha256((byte *) &tc, sizeof(TFCHECK) - HASHLEN, tc.hash);
+   Tfcheckblock = get32(tc.ts.bnum);
+   if(Trace) plog("tfcheck_save(): at 0x%x from 0x%x", Tfcheckblock, count);
+   return write_data(&tc, sizeof(TFCHECK), "tfile.chk");
+}  /* end tfcheck_save() */
+
+
+/* Validate fname as tfval() does, but only past the checkpoint
+ * in tfile.chk if it matches the start of fname.  On success,
+ * the state after the last trailer is kept for tfcheck_save().
+ * Returns and sets *result as tfval().
+ */
+byte *tfresume(char *fname, byte *highblock, int *result)
+{
+   FILE *fp;
+   TFCHECK tc;
+   SHA256_CTX ctx, ctx2;
+   byte hash[HASHLEN];
+   static byte weight[HASHLEN];   /* return value */
+   long filelen;
+   word32 count;
+
+   Ntfstate = 0;
+   if(Trustblock) return tfval(fname, highblock, 0, result);
+   fp = fopen(fname, "rb");
+   if(fp == NULL) return tfval(fname, highblock, 0, result);
+   fseek(fp, 0, SEEK_END);
+   filelen = ftell(fp);
+   if((filelen % sizeof(BTRAILER)) != 0) {
+      fclose(fp);
+      return tfval(fname, highblock, 0, result);
+   }
+
+   count = 0;
+   if(!Tfcheckall
+      && read_data(&tc, sizeof(TFCHECK), "tfile.chk") == sizeof(TFCHECK)) {
+      sha256((byte *) &tc, sizeof(TFCHECK) - HASHLEN, hash);
+      if(memcmp(hash, tc.hash, HASHLEN) != 0)
+         plog("tfresume(): bad tfile.chk");
+      else count = get32(tc.ts.bnum);
+   }
+   sha256_init(&ctx);
+   if(count) {
+      fseek(fp, 0, SEEK_SET);
+      if(filelen / sizeof(BTRAILER) < count
+         || tfhash_add(fp, count, &ctx) != VEOK) count = 0;
+      else {
+         memcpy(&ctx2, &ctx, sizeof(SHA256_CTX));
+         sha256_final(&ctx2, hash);
+         if(memcmp(hash, tc.tfhash, HASHLEN) != 0) count = 0;
+      }
+      if(count == 0) {
+         plog("tfresume(): tfile.chk does not match %s", fname);
+         sha256_init(&ctx);
+      }
+   }
+   if(count == 0 && tfinit(&tc.ts) != VEOK) {
+      fclose(fp);
+      return tfval(fname, highblock, 0, result);
+   }
+
+   show("tfval");
+   if(Trace) plog("tfresume(): from 0x%x", count);
+   fseek(fp, (long) count * sizeof(BTRAILER), SEEK_SET);
+   *result = tfval2(fp, &tc.ts, 0, 0);
+   if(*result == 0) {
+      /* hash the trailers just checked to keep the final state */
+      fseek(fp, (long) count * sizeof(BTRAILER), SEEK_SET);
+      if(tfhash_add(fp, get32(tc.ts.bnum) - count, &ctx) == VEOK)
+         tfcheck_keep(&tc.ts, &ctx);
+   }
+   fclose(fp);
+   sub64(tc.ts.bnum, One, highblock);
+   memcpy(weight, tc.ts.weight, HASHLEN);
+   Tfcheckblock = get32(tc.ts.bnum);
+   if(Trace) plog("tfresume(): ecode = %d  bnum = 0x%s  weight = 0x...%x",
+                  *result, bnum2hex(highblock), weight[0]);
+   return weight;
+}  /* end tfresume() */
+
+
+/* Bring tfile.dat up to peer ip's tfile, fetching only the trailers
+ * after the highest one that we have in common with her.
+ * Ours up to there were validated by init(), so their weight is just
+ * summed, and only the new trailers are validated from that state.
+ * Returns NULL if there is nothing in common or on I/O error,
+ * else as tfval() with the new tfile in tfile.new if it is valid.
+ * tfile.dat is not changed: the caller decides whether to keep hers.
+ */
+byte *tfdelta(word32 ip, byte *highbnum, byte *highblock, int *result)
+{
+   FILE *fp, *fpnew;
+   TFSTATE ts;
+   BTRAILER *tfbuff, bt, bt2;
+   static byte weight[HASHLEN];   /* return value */
+   word32 n, top, first, lo, hi, mid;
+   int count, same;
+
+   if(Trace) plog("Entering tfdelta()");
+   show("tfdelta");
+
+   tfbuff = NULL;
+   fpnew = NULL;
+   fp = fopen("tfile.dat", "rb");
+   if(fp == NULL) return NULL;
+   fseek(fp, 0, SEEK_END);
+   n = ftell(fp) / sizeof(BTRAILER);
+   top = get32(highbnum);
+   if(top >= n) top = n - 1;
+   if(n < 2 || top < 1) goto fail;
+   tfbuff = malloc(MAXTF * sizeof(BTRAILER));
+   if(tfbuff == NULL) goto fail;
+
+   /* Look for the highest common trailer near her top first... */
+   count = top < MAXTF ? top : MAXTF;
+   first = top - count + 1;
+   count = get_tf(ip, first, count, tfbuff);
+   if(count < 0) goto fail;
+   for(lo = 0; count > 0; count--) {
+      if(fseek(fp, (first + count - 1) * sizeof(BTRAILER), SEEK_SET) != 0
+         || fread(&bt, 1, sizeof(BTRAILER), fp) != sizeof(BTRAILER))
+            goto fail;
+      if(memcmp(bt.bhash, tfbuff[count - 1].bhash, HASHLEN) == 0) {
+         lo = first + count - 1;
+         break;
+      }
+   }
+   /* ...then bisect below the window, where the Genesis Block is common. */
+   if(count == 0) {
+      for(hi = first; hi - lo > 1; ) {
+         mid = lo + (hi - lo) / 2;
+         if(get_tf(ip, mid, 1, &bt2) != 1) goto fail;
+         if(fseek(fp, mid * sizeof(BTRAILER), SEEK_SET) != 0
+            || fread(&bt, 1, sizeof(BTRAILER), fp) != sizeof(BTRAILER))
+               goto fail;
+         if(memcmp(bt.bhash, bt2.bhash, HASHLEN) == 0) lo = mid;
+         else hi = mid;
+      }
+   }
+   if(lo == 0) goto fail;  /* a full download is cheaper */
+   if(Trace) plog("tfdelta(): common trailer 0x%x of 0x%x", lo, top);
+
+   /* Our trailers through lo resume her tfile from lo + 1. */
+   fpnew = fopen("tfile.prt", "wb");
+   if(fpnew == NULL) goto fail;
+   fseek(fp, 0, SEEK_SET);
+   for(n = 0; n <= lo; n++) {
+      if(fread(&bt, 1, sizeof(BTRAILER), fp) != sizeof(BTRAILER)) goto fail;
+      if(fwrite(&bt, 1, sizeof(BTRAILER), fpnew) != sizeof(BTRAILER))
+         goto fail;
+   }
+   fclose(fpnew);
+   fpnew = NULL;
+   if(get_block2(ip, NULL, "tfile.new", OP_GET_TFILE) != VEOK) goto fail;
+
+   fpnew = fopen("tfile.new", "rb");
+   if(fpnew == NULL) goto fail;
+   fseek(fpnew, 0, SEEK_END);
+   if((ftell(fpnew) % sizeof(BTRAILER)) != 0) goto fail;
+   /* She may have sent all of it if she cannot resume. */
+   fseek(fp, 0, SEEK_SET);
+   fseek(fpnew, 0, SEEK_SET);
+   for(same = 1, n = 0; same && n <= lo; n++) {
+      if(fread(&bt, 1, sizeof(BTRAILER), fp) != sizeof(BTRAILER)
+         || fread(&bt2, 1, sizeof(BTRAILER), fpnew) != sizeof(BTRAILER)
+         || memcmp(&bt, &bt2, sizeof(BTRAILER)) != 0) same = 0;
+   }
+   fclose(fp);
+   fp = NULL;
+   free(tfbuff);
+   tfbuff = NULL;
+
+   if(tfinit(&ts) != VEOK) goto fail;
+   fseek(fpnew, 0, SEEK_SET);
+   *result = 0;
+   if(same) *result = tfval2(fpnew, &ts, lo + 1, 1);
+   if(*result == 0) *result = tfval2(fpnew, &ts, 0, 0);
+   fclose(fpnew);
+   sub64(ts.bnum, One, highblock);
+   memcpy(weight, ts.weight, HASHLEN);
+   if(Trace) plog("tfdelta(): ecode = %d  bnum = 0x%s  weight = 0x...%x",
+                  *result, bnum2hex(highblock), weight[0]);
+   if(*result) unlink("tfile.new");
+   return weight;
+
+fail:
+   if(fp) fclose(fp);
+   if(fpnew) fclose(fpnew);
+   if(tfbuff) free(tfbuff);
+   unlink("tfile.prt");
+   unlink("tfile.new");
+   if(Trace) plog("tfdelta(): no delta");
+   return NULL;
+}  /* end tfdelta() */
+
+
 /* Delete all blocks above bc/matchblock.
  * Returns number of blocks deleted.
  */
@@ -662,12 +1113,17 @@ int get_eon(NODE *np, word32 peerip)
 {
    FILE *fp, *tofp;           /* to "lock" and copy files */
    pid_t gpid[MAXQUORUM];     /* Gang children */
+   pid_t vpid[MAXPOWPROCS];   /* preval() children */
    word32 gang[MAXQUORUM];
+   word32 plist[RPLISTLEN], ipl[IPLPROBES];  /* peers to ask, answered */
+   word32 asked[RPLISTLEN];   /* peers asked for quorum since top */
+   static TX ipltx[IPLPROBES];  /* their answers */
    byte bnum[8], ngnum[8], highbnum[8];
    byte dlbnum[8], clbnum[8];  /* download/clear block number */
+   byte vbnum[MAXPOWPROCS][8], pvbnum[8];  /* checked/to check ahead */
    byte highhash[HASHLEN], *tfweight;
    byte highweight[HASHLEN];
-   int i, j, k, n, result;
+   int i, j, k, n, v, nval, nasked, result;
    size_t cpbytes;            /* neo-gen transfer */
    char cpbuff[NGBUFFLEN];    /* neo-gen transfer */
    char fname[128], tofname[128];
@@ -677,6 +1133,7 @@ int get_eon(NODE *np, word32 peerip)
    plog("Entering get_eon()");
 
    timeout = time(NULL) + 300;
+   memset(vpid, 0, sizeof(vpid));
 
 top:
    memset(gpid, 0, sizeof(pid_t)*MAXQUORUM);
@@ -684,6 +1141,7 @@ top:
    k = 0;
    tfweight = NULL;
    gang[0] = peerip;
+   nasked = 0;
    put64(highbnum, np->tx.cblock);
    memcpy(highhash, np->tx.cblockhash, HASHLEN);
    memcpy(highweight, np->tx.weight, HASHLEN);
@@ -698,18 +1156,36 @@ top:
    for(j = 1; j < Quorum && Running; ) {
       if(Monitor && Bgflag == 0) resign("user break 1");  /* DSL */
       if(time(NULL) >= timeout) goto try_again;
-      /* select random peer from Rplist */
-      for(peerip = n = 0; peerip == 0 && Running && n < 1000; n++)
-         peerip = Rplist[rand16() % RPLISTLEN];
-      /* no duplicate gang[] members */
-      if(search32(peerip, gang, Quorum) != NULL) continue;
-      /* fetch her ip list and compare block height/weight/hash */
-      if(get_ipl(np, peerip) != VEOK) continue;
-      result = cmp_weight(np->tx.weight, highweight);
-      if(result > 0) goto top;
-      if(result != 0) continue;
-      if(memcmp(highhash, np->tx.cblockhash, HASHLEN) != 0) continue;
-      gang[j++] = peerip;
+      /* ask the best scored peers not yet asked at once,
+       * moving on through Rplist[] as it grows
+       */
+      memcpy(plist, Rplist, sizeof(plist));
+      peer_sort(plist, RPLISTLEN);
+      for(i = n = 0; i < RPLISTLEN && n < IPLPROBES; i++) {
+         if(nasked >= RPLISTLEN) break;
+         /* no duplicate gang[] members */
+         if(plist[i] == 0 || search32(plist[i], gang, Quorum) != NULL
+            || search32(plist[i], asked, nasked) != NULL) continue;
+         asked[nasked++] = plist[i];
+         plist[n++] = plist[i];
+      }
+      if(n == 0) goto try_again;  /* all asked */
+      /* fetch their ip lists and compare block height/weight/hash,
+       * fastest first
+       */
+      n = get_ipls(plist, n, n, ipltx, ipl);
+      for(i = 0; i < n && j < Quorum; i++) {
+         result = cmp_weight(ipltx[i].weight, highweight);
+         if(result > 0) {
+            memcpy(&np->tx, &ipltx[i], sizeof(TX));
+            peerip = ipl[i];
+            goto top;
+         }
+         if(result != 0) continue;
+         if(memcmp(highhash, ipltx[i].cblockhash, HASHLEN) != 0) continue;
+         gang[j++] = ipl[i];
+      }
+      if(n == 0) sleep(1);
    }
    if(!Running) resign("quorum debate");  /* System/360 Emergency Pull! */
 
@@ -719,17 +1195,31 @@ top:
     */
    show("tfile");
    plog("Downloading tfile");
-   unlink("tfile.dat");
+   peer_sort(gang, Quorum);  /* ask the best peer first */
    if(Trace) plog("   fetching tfile.dat from %s", ntoa((byte *) &gang[0]));
    for(k = 0; k < Quorum && Running; k++) {
       if(Monitor && Bgflag == 0) resign("user break 2");  /* DSL */
       peerip = gang[k];
-      if(get_block2(peerip, NULL, "tfile.dat", OP_GET_TFILE) != VEOK)
-         continue;  /* try to get block again from next peer in gang[] */
-      tfweight = tfval("tfile.dat", bnum, 0, &result);
-      if(result) goto try_again;  /* I/O error */
-      if(cmp64(highbnum, bnum) > 0) goto try_again;
-      if(cmp_weight(tfweight, highweight) < 0) goto try_again;
+      /* fetch only the trailers we do not have, if we can */
+      tfweight = tfdelta(peerip, highbnum, bnum, &result);
+      if(tfweight == NULL) {
+         if(get_block2(peerip, NULL, "tfile.new", OP_GET_TFILE) != VEOK)
+            continue;  /* try to get block again from next peer in gang[] */
+         tfweight = tfval("tfile.new", bnum, 0, &result);
+      }
+      /* tfile.dat must only ever hold a validated tfile,
+       * since tfdelta() sums the weight of ours without checking it.
+       */
+      if(result || cmp64(highbnum, bnum) > 0
+         || cmp_weight(tfweight, highweight) < 0) {
+         unlink("tfile.new");
+         goto try_again;
+      }
+      unlink("tfile.dat");
+      if(rename("tfile.new", "tfile.dat") != 0) {
+         error("get_eon(): cannot rename tfile.new");
+         goto try_again;
+      }
       break;  /* success */
    }
    if(!Running) resign("quorum tfile");
@@ -823,6 +1313,8 @@ top:
    printf("Downloading blockchain...\n");
    put64(clbnum, bnum);
    add64(bnum, One, bnum);
+   put64(pvbnum, bnum);
+   nval = pow_nproc();
    for( ; Running; ) {
       put64(dlbnum, bnum);
       /* i -> count children finished downloading
@@ -879,9 +1371,32 @@ top:
       }  /* end for thread handling */
       /* sleep cpu during no activity */
       if(!i && Dynasleep) usleep(Dynasleep);
+      /* check work and signatures of downloaded blocks ahead
+       * of bnum on the other cores, so update() need not
+       */
+      for(v = 0; v < nval; v++) {
+         if(vpid[v] > 0 && waitpid(vpid[v], NULL, WNOHANG) > 0)
+            vpid[v] = 0;
+         if(vpid[v] > 0) continue;
+         if(cmp64(pvbnum, bnum) <= 0) add64(bnum, One, pvbnum);
+         if(pvbnum[0] == 0) add64(pvbnum, One, pvbnum);
+         if(get32(pvbnum) - get32(bnum) > PREVALAHEAD) break;
+         sprintf(fname, "rblock%02X%02X.dat", pvbnum[1], pvbnum[0]);
+         if(!exists(fname)) break;
+         put64(vbnum[v], pvbnum);
+         vpid[v] = preval_fork(fname, pvbnum);
+         add64(pvbnum, One, pvbnum);
+      }
       /* update downloaded blocks (also constructs NG on 0xff blocks) */
       sprintf(fname, "rblock%02X%02X.dat", bnum[1], bnum[0]);
       while (exists(fname)) {
+         /* let a check ahead of this block finish */
+         for(v = 0; v < nval; v++) {
+            if(vpid[v] > 0 && cmp64(vbnum[v], bnum) == 0) {
+               waitpid(vpid[v], NULL, 0);
+               vpid[v] = 0;
+            }
+         }
          if(update(fname, 0) != VEOK) goto try_again;
          add64(bnum, One, bnum);
          if(bnum[0] == 0) add64(bnum, One, bnum);
@@ -893,6 +1408,7 @@ top:
          goto try_again;
       }
    }  /* end for block download-update */
+   preval_end(vpid, MAXPOWPROCS);
 
    /* Post-sync hook for external SQL database export */
    /* Shell script in /bin directory */
@@ -915,6 +1431,7 @@ top:
       goto try_again;
    }
    memcpy(Weight, tfweight, HASHLEN);
+   rmfiles(".", ".prt");  /* partial downloads that were never resumed */
 
    if(Trace) plog("re-computed Weight = 0x...%x", Weight[0]);
    plog("Veronica says, 'You're done!'");
@@ -922,6 +1439,7 @@ top:
    return VEOK;
 
 try_again:
+   preval_end(vpid, MAXPOWPROCS);
    plog(":) (k: %d  Will restart in %d seconds.)", k,
         (int) (timeout - time(NULL)));
    if(Trace) {
@@ -935,9 +1453,11 @@ try_again:
    if(time(NULL) >= timeout) restart(":) timeout");  /* v.28 */
    if(Monitor && Bgflag == 0) resign("user break 5");  /* DSL */
 
-   for(peerip = n = 0; peerip == 0 && Running && n < 1000; n++)
-      peerip = Rplist[rand16() % RPLISTLEN];
-   if(get_ipl(np, peerip) != VEOK && Running) goto try_again;
+   /* start over from the first peer to answer */
+   memcpy(plist, Rplist, sizeof(plist));
+   peer_sort(plist, RPLISTLEN);
+   if(get_ipls(plist, RPLISTLEN, 1, &np->tx, &peerip) == 0 && Running)
+      goto try_again;
    if(Running) goto top;  /* v.28 */
    resign("try again");
    return VERROR;  /* never gets here */
@@ -959,6 +1479,9 @@ int init(void)
 
    plog("Entering init()");
    show("init");
+   mkdir("undo", 0777);  /* for bup's ledger undo records */
+   rmfiles(".", ".prt");  /* stale partial downloads */
+   init_checkpt(Ckfname);
 
    /* open ledger read-only */
    if(!exists("ledger.dat") || le_open("ledger.dat", "rb") != VEOK) {
@@ -979,12 +1502,13 @@ int init(void)
       error("init(): reset_difficulty()");
 
    /* Read and validate our own tfile.dat to compute Weight */
-   wp = tfval("tfile.dat", highblock, 0, &result);
+   wp = tfresume("tfile.dat", highblock, &result);
    if(result || cmp64(Cblocknum, highblock) != 0) {
       plog("init(): %d %d", Cblocknum[0], highblock[0]);
       fatal("init(): bad tfile.dat -- gomochi!");
    }
    memcpy(Weight, wp, HASHLEN);
+   tfcheck_save(1);
 
    /* read local nodes into Lplist */
    read_localipl(Lpfname);
@@ -44,34 +44,35 @@ void le_close(void)
 }
 
 
-/* Binary search ledger.dat (Lefp) for addr.
+/* Binary search ledger.dat (Lefp) for addr from index low up.
  * input: addr
  * outputs: *le, *position, and return code.
  * Returns 1 if found, 0 if not found.
  * If found, le is filled in with ledger entry.
  * If position is non-NULL put the index of found LENTRY struct there,
  * else the index of where to insert addr in ledger.dat.
+ * When looking up sorted addresses, the position of each is the
+ * low index for the next.
  */
-int le_find(byte *addr, LENTRY *le, long *position, int mode)
+int le_find2(byte *addr, LENTRY *le, long *position, int mode, long low)
 {
-   long cond, mid, hi, low;
+   long cond, mid, hi;
    size_t addrlen;
 
    if(Lefp == NULL) {
-      Lerror = error("le_find(): use le_open() first!");
+      Lerror = error("le_find2(): use le_open() first!");
       return 0;
    }
 
-   low = 0;
    hi = Nledger - 1;
    if(mode == 1) addrlen = TXADDRLEN-12; else addrlen = TXADDRLEN;
 
    while(low <= hi) {
       mid = (hi + low) / 2;
       if(fseek(Lefp, mid * sizeof(LENTRY), SEEK_SET) != 0)
-         { Lerror = error("le_find(): fseek");  break; }
+         { Lerror = error("le_find2(): fseek");  break; }
       if(fread(le, 1, sizeof(LENTRY), Lefp) != sizeof(LENTRY))
-         { Lerror = error("le_find(): fread");  break; }
+         { Lerror = error("le_find2(): fread");  break; }
       cond = memcmp(addr, le->addr, addrlen);
       if(cond == 0) {
          if(position) *position = mid;
@@ -85,4 +86,11 @@ int le_find(byte *addr, LENTRY *le, long *position, int mode)
     */
    if(position) *position = low;
    return 0;  /* not found */
-}  /* end le_find() */
+}  /* end le_find2() */
+
+
+/* Binary search all of ledger.dat for addr.  See le_find2(). */
+int le_find(byte *addr, LENTRY *le, long *position, int mode)
+{
+   return le_find2(addr, le, position, mode, 0);
+}
@@ -0,0 +1,78 @@
+/* limit.c  Token buckets to limit costly requests per peer and overall.
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+*/
+
+
+/* OP_TX admission: per ip, and for all TX signature checks.
+ * Rates are tokens per second; a rate of zero disables the limit.
+ */
+word32 Iprate = TXIPRATE, Ipburst = TXIPBURST;
+word32 Txrate = TXRATE, Txburst = TXBURST;
+BUCKET Ipbucket[LIMITLEN];
+BUCKET Txbucket;
+
+
+/* Add the tokens that bp earned at rate since its last use, up to
+ * burst.  Tokens are kept in 1/1000's so that one is earned per ms
+ * at a rate of 1000 per second.
+ */
+void refill(BUCKET *bp, word32 rate, word32 burst, word32 now)
+{
+   double tokens;
+
+   tokens = bp->tokens + (double) (word32) (now - bp->time) * rate;
+   if(tokens > burst * 1000.0) tokens = burst * 1000.0;
+   bp->tokens = (word32) tokens;
+   bp->time = now;
+}
+
+
+/* Find the bucket for ip.  A new ip takes an empty or the least
+ * recently used bucket near its hash, and starts with a full bucket.
+ */
+BUCKET *ipbucket(word32 ip, word32 now)
+{
+   BUCKET *bp, *old;
+   word32 j, h;
+
+   h = (ip * 2654435761U) % LIMITLEN;
+   for(old = NULL, j = 0; j < LIMITPROBE; j++) {
+      bp = &Ipbucket[(h + j) % LIMITLEN];
+      if(bp->ip == ip) return bp;
+      if(old == NULL || bp->ip == 0
+         || (old->ip != 0 && (int) (bp->time - old->time) < 0)) old = bp;
+   }
+   old->ip = ip;
+   old->tokens = Ipburst * 1000;
+   old->time = now;
+   return old;
+}  /* end ipbucket() */
+
+
+/* Take a token for an OP_TX from ip, before any signature work.
+ * Returns VEOK if her TX may be validated, else VERROR.
+ */
+int tx_admit(word32 ip)
+{
+   BUCKET *bp;
+   word32 now;
+
+   now = mtime();
+   bp = NULL;
+   if(Iprate) {
+      bp = ipbucket(ip, now);
+      refill(bp, Iprate, Ipburst, now);
+      if(bp->tokens < 1000) return VERROR;
+   }
+   if(Txrate) {
+      refill(&Txbucket, Txrate, Txburst, now);
+      if(Txbucket.tokens < 1000) return VERROR;
+      Txbucket.tokens -= 1000;
+   }
+   if(bp) bp->tokens -= 1000;
+   return VEOK;
+}  /* end tx_admit() */
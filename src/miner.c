@@ -25,6 +25,48 @@ void trigg_generate_cuda(byte *mroot, word32 *hps, byte *runflag);
 
 uint8_t nvml_init = 0;
 
+/* Copy the candidate block in fname to solved file sname,
+ * with the solved trailer bt in place of its own.
+ * Returns VEOK on success, else VERROR.
+ */
+int solved_copy(char *fname, char *sname, BTRAILER *bt)
+{
+   FILE *fp, *sfp;
+   byte buff[BUFSIZ];
+   long len;
+   size_t n;
+
+   if((fp = fopen(fname, "rb")) == NULL) {
+      if(Trace) plog("miner: cannot re-open %s", fname);
+      return VERROR;
+   }
+   if((sfp = fopen(sname, "wb")) == NULL) {
+      fclose(fp);
+      return error("miner: cannot open %s", sname);
+   }
+   if(fseek(fp, 0, SEEK_END) != 0) goto bad;
+   len = ftell(fp) - sizeof(BTRAILER);
+   if(len < 0 || fseek(fp, 0, SEEK_SET) != 0) goto bad;
+   for( ; len > 0; len -= n) {
+      n = len < (long) sizeof(buff) ? (size_t) len : sizeof(buff);
+      if(fread(buff, 1, n, fp) != n) goto bad;
+      if(fwrite(buff, 1, n, sfp) != n) goto bad;
+   }
+   if(fwrite(bt, 1, sizeof(BTRAILER), sfp) != sizeof(BTRAILER)) goto bad;
+   fclose(fp);
+   if(fclose(sfp) != 0) {
+      unlink(sname);
+      return error("miner: cannot write %s", sname);
+   }
+   return VEOK;
+bad:
+   fclose(fp);
+   fclose(sfp);
+   unlink(sname);
+   return error("miner: cannot copy %s to %s", fname, sname);
+}  /* end solved_copy() */
+
+
 /* miner blockin blockout -- child process */
 int miner(char *blockin, char *blockout)
 {
@@ -176,27 +218,14 @@ int miner(char *blockin, char *blockout)
        */
       sha256_update(&bctx, bt.nonce, HASHLEN + 4);
       sha256_final(&bctx, bt.bhash);  /* put hash in block trailer */
-      fp = fopen("miner.tmp", "r+b");
-      if(fp == NULL) {
-         if(Trace) plog("miner: cannot re-open miner.tmp");
-         break;
-      }
-      if(fseek(fp, -(sizeof(BTRAILER)), SEEK_END) != 0) {
-         fclose(fp);
-         error("miner: cannot fseek(trailer) miner.tmp");
-         break;
-      }
-      if(fwrite(&bt, 1, sizeof(bt), fp) != sizeof(bt)) {
-         fclose(fp);
-         error("miner: cannot fwrite(trailer) miner.tmp");
-         break;
-      }
-      fclose(fp);
+      /* miner.tmp stays whole for send_cblock() */
+      if(solved_copy("miner.tmp", "miner.sol", &bt) != VEOK) break;
       unlink(blockout);
-      if(rename("miner.tmp", blockout) != 0) {
-         error("miner: cannot rename miner.tmp");
+      if(rename("miner.sol", blockout) != 0) {
+         error("miner: cannot rename miner.sol");
          break;
       }
+      unlink("miner.tmp");
 
       if(Trace)
          plog("miner: solved block 0x%s is now: %s",
@@ -22,14 +22,18 @@
 #include "util.c"       /* server support */
 #include "sock.c"       /* inet utilities */
 #include "pink.c"       /* manage pinklist                 */
+#include "peer.c"       /* score peers                     */
+#include "limit.c"      /* token buckets for OP_TX         */
 #include "connect.c"    /* make outgoing connection        */
 #include "call.c"       /* callserver() and friends        */
 #include "ledger.c"
 #include "tag.c"        /* address tag support             */
+#include "powcache.c"   /* skip checking work twice        */
 #include "gettx.c"      /* poll and read NODE socket       */
 #include "txval.c"      /* validate transactions           */
 #include "mirror.c"
 #include "execute.c"
+#include "query.c"      /* workers for balance and tags    */
 #include "phost.c"      /* utility to print host info      */
 #include "monitor.c"    /* system monitor/debugger prompt  */
 #include "daemon.c"
@@ -38,6 +42,9 @@
 #include "miner.c"
 #include "pval.c"       /* pseudo-blocks                   */
 #include "optf.c"       /* for OP_HASH and OP_TF           */
+#include "powval.c"     /* tfile PoW on all cores          */
+#include "chkpoint.c"   /* trusted tfile checkpoints       */
+#include "tfmap.c"      /* mapped tfile.dat                */
 #include "proof.c"
 #include "renew.c"
 #include "update.c"
@@ -120,7 +120,7 @@ pid_t mirror1(word32 *iplist, int len)
    if(Trace) plog("mirror()...");
    show("mirror");
 
-   shuffle32(iplist, len);  /* NOTE: can create embedded zeros. */
+   peer_sort(iplist, len);  /* best first and zeros last */
    /* Create up to len mgc() grandchildren */
    for(j = 0; j < len; j++) {
       if(iplist[j] == 0) { peer[j] = 0; continue; }
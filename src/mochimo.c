@@ -33,14 +33,18 @@
 #include "util.c"       /* server support */
 #include "sock.c"       /* inet utilities */
 #include "pink.c"       /* manage pinklist                 */
+#include "peer.c"       /* score peers                     */
+#include "limit.c"      /* token buckets for OP_TX         */
 #include "connect.c"    /* make outgoing connection        */
 #include "call.c"       /* callserver() and friends        */
 #include "ledger.c"
 #include "tag.c"        /* address tag support             */
+#include "powcache.c"   /* skip checking work twice        */
 #include "gettx.c"      /* poll and read NODE socket       */
 #include "txval.c"      /* validate transactions           */
 #include "mirror.c"
 #include "execute.c"
+#include "query.c"      /* workers for balance and tags    */
 #include "phost.c"      /* utility to print host info      */
 #include "monitor.c"    /* system monitor/debugger prompt  */
 #include "daemon.c"
@@ -49,6 +53,9 @@
 #include "miner.c"
 #include "pval.c"       /* pseudo-blocks                   */
 #include "optf.c"       /* for OP_HASH and OP_TF           */
+#include "powval.c"     /* tfile PoW on all cores          */
+#include "chkpoint.c"   /* trusted tfile checkpoints       */
+#include "tfmap.c"      /* mapped tfile.dat                */
 #include "proof.c"
 #include "renew.c"
 #include "update.c"
@@ -82,6 +89,13 @@ void usage(void)
           "         -Mn        set transaction fee to n\n"
           "         -Sanctuary=N,Lastday\n"
           "         -Tn        set Trustblock to n for tfval() speedup\n"
+          "         -C         validate all of tfile.dat, not from tfile.chk\n"
+          "                    or checkpoints\n"
+          "         -kFNAME    read tfile checkpoints from FNAME\n"
+          "         -QN        run N balance and tag query workers\n"
+          "         -WN        check tfile proof of work on N cores\n"
+          "         -rN,B      limit OP_TX per peer to N/sec. bursting to B\n"
+          "         -RN,B      limit OP_TX validated to N/sec. bursting to B\n"
    );
 #ifdef BX_MYSQL
    printf("         -X         Export to MySQL database on block update\n");
@@ -195,6 +209,22 @@ int main(int argc, char **argv)
                     break;
          case 'T':  Trustblock = atoi(&argv[j][2]);
                     break;
+         case 'C':  Tfcheckall = 1;
+                    break;
+         case 'k':  Ckfname = &argv[j][2];  /* more checkpoints */
+                    break;
+         case 'Q':  Queryprocs = atoi(&argv[j][2]);  /* 0 = none */
+                    break;
+         case 'W':  Powprocs = atoi(&argv[j][2]);  /* 0 = all */
+                    break;
+         case 'r':  Iprate = strtoul(&argv[j][2], &cp, 0);  /* 0 = off */
+                    if(*cp == ',') Ipburst = strtoul(cp + 1, NULL, 0);
+                    if(Ipburst < 1) usage();
+                    break;
+         case 'R':  Txrate = strtoul(&argv[j][2], &cp, 0);
+                    if(*cp == ',') Txburst = strtoul(cp + 1, NULL, 0);
+                    if(Txburst < 1) usage();
+                    break;
 #ifdef BX_MYSQL
          case 'X':  Exportflag = 1;
                     break;
@@ -212,6 +242,7 @@ int main(int argc, char **argv)
    fix_signals();
    signal(SIGCHLD, SIG_DFL);  /* so waitpid() works */
 
+   peer_init();  /* before the first fork() */
    init();  /* fetch initial block chain */
    if(!Bgflag) printf("\n");
 
@@ -230,6 +261,8 @@ int main(int argc, char **argv)
    plog("Server exiting . . .");
    save_rplist();
    savepink();
+   peer_save();
+   tfcheck_save(1);  /* for the next init() */
    pause_server();
    return 0;              /* never gets here */
 } /* end main() */
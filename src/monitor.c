@@ -40,16 +40,21 @@ int stats(int showflag)
                "   Server errors:   %u\n"
                "   TX recvd:        %u\n"
                "   Balances sent:   %u\n"
+               "   Query workers:   %u\n"
                "   TX dups:         %u\n"
+               "   TX rate limited: %u\n"
                "   txq1 count:      %u\n"
                "   Sends blocked:   %u\n"
                "   Blocks solved:   %u\n"
                "   Blocks updated:  %u\n"
+               "   Queued found/sync/query: %u/%u/%u  (most %u/%u/%u)\n"
                "\n",
                 Eon, Ngen,
                 Nonline, Nlogins, Nbadlogs, Nspace, Ntimeouts,
-                Nerrors, Nrec, Nsent, Ndups, Txcount, Nsenderr,
-                Nsolved, Nupdated
+                Nerrors, Nrec, Nsent, Nqueries, Ndups, Nlimited, Txcount, Nsenderr,
+                Nsolved, Nupdated,
+                Qdepth[PRI_FOUND], Qdepth[PRI_SYNC], Qdepth[PRI_QUERY],
+                Qmax[PRI_FOUND], Qmax[PRI_SYNC], Qmax[PRI_QUERY]
    );
 
    printf("Current block: 0x%s\n", bnum2hex(Cblocknum));
@@ -13,23 +13,19 @@
  */
 int send_tf(NODE *np)
 {
-   int status;
    word32 first, count;
-   char cmd[128], fname[32];
-
-   sprintf(fname, "tf%u.tmp", (int) getpid());
 
    first = get32(np->tx.blocknum);      /* first trailer to send */
    count = get32(&np->tx.blocknum[4]);  /* count of trailers to send */
 
-   /* limit tfile extract to 1000 trailers */
-   if(count > 1000) return VERROR;
-   sprintf(cmd, "dd if=tfile.dat of=%s bs=%u skip=%u count=%u 2>/dev/null",
-                fname, (int) sizeof(BTRAILER), first, count);
-   system(cmd);
-   status = send_file(np, fname);  /* returns VEOK or VERROR */
-   unlink(fname);
-   return status;
+   /* limit tfile extract to MAXTF trailers */
+   if(count > MAXTF) return VERROR;
+   if(count == 0) {
+      put16(np->tx.len, 0);  /* empty, as the file from dd was */
+      return send_op(np, OP_SEND_BL);
+   }
+   return send_part(np, "tfile.dat", (long) first * sizeof(BTRAILER),
+                    (long) count * sizeof(BTRAILER));
 }  /* end send_tf() */
 
 
@@ -0,0 +1,215 @@
+/* peer.c  Score peers by speed and reliability to choose among them.
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+*/
+
+#include <sys/mman.h>
+
+/* PEERLEN scores in memory shared with all children, so that
+ * callserver() and friends in a child score for the parent.
+ * Children update without locks: a lost update only costs accuracy.
+ */
+PEERSCORE *Peerscore;
+
+
+/* Map the shared score table and read in peers.dat.
+ * Call before the first fork().
+ */
+int peer_init(void)
+{
+   Peerscore = mmap(NULL, PEERLEN * sizeof(PEERSCORE),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if(Peerscore == MAP_FAILED) {
+      Peerscore = NULL;
+      return error("peer_init(): cannot map peer scores");
+   }
+   read_data(Peerscore, PEERLEN * sizeof(PEERSCORE), "peers.dat");
+   return VEOK;
+}
+
+
+/* Save the score table to disk. */
+int peer_save(void)
+{
+   if(Peerscore == NULL) return VERROR;
+   if(Trace) plog("saving peer scores...");
+   return write_data(Peerscore, PEERLEN * sizeof(PEERSCORE), "peers.dat");
+}
+
+
+/* Find the score entry for ip.  If add is non-zero and ip has none,
+ * take an empty or the stalest entry near its hash.
+ * Returns NULL if not found.
+ */
+PEERSCORE *peer_find(word32 ip, int add)
+{
+   PEERSCORE *pp, *old;
+   word32 j, h;
+
+   if(Peerscore == NULL || ip == 0) return NULL;
+   h = (ip * 2654435761U) % PEERLEN;
+   for(old = NULL, j = 0; j < PEERPROBE; j++) {
+      pp = &Peerscore[(h + j) % PEERLEN];
+      if(pp->ip == ip) return pp;
+      if(old == NULL || pp->ip == 0
+         || (old->ip != 0 && pp->seen < old->seen)) old = pp;
+   }
+   if(!add) return NULL;
+   memset(old, 0, sizeof(PEERSCORE));
+   old->ip = ip;
+   return old;
+}  /* end peer_find() */
+
+
+/* Age the counts so that the score follows recent behaviour. */
+void peer_age(PEERSCORE *pp)
+{
+   pp->seen = time(NULL);
+   if(pp->ok + pp->fail + pp->nack < PEERAGE) return;
+   pp->ok /= 2;
+   pp->fail /= 2;
+   pp->nack /= 2;
+   pp->bad /= 2;
+}
+
+
+/* Record a good callserver() to ip that took ms milliseconds. */
+void peer_rtt(word32 ip, word32 ms)
+{
+   PEERSCORE *pp;
+
+   pp = peer_find(ip, 1);
+   if(pp == NULL) return;
+   if(pp->rtt == 0) pp->rtt = ms + 1;
+   else pp->rtt = (pp->rtt * 7 + ms + 1) / 8;  /* moving average */
+   pp->ok++;
+   peer_age(pp);
+}
+
+
+/* Record a download of len bytes from ip in ms milliseconds. */
+void peer_rate(word32 ip, long len, word32 ms)
+{
+   PEERSCORE *pp;
+   word32 rate;
+
+   pp = peer_find(ip, 1);
+   if(pp == NULL || len < TRANLEN) return;  /* too short to time */
+   rate = (word32) ((double) len * 1000.0 / (ms + 1));
+   if(pp->rate == 0) pp->rate = rate;
+   else pp->rate = (word32) (((double) pp->rate * 7 + rate) / 8);
+   peer_age(pp);
+}
+
+
+/* Record a failed call to ip: refused or timed out. */
+void peer_fail(word32 ip)
+{
+   PEERSCORE *pp;
+
+   pp = peer_find(ip, 1);
+   if(pp == NULL) return;
+   pp->fail++;
+   peer_age(pp);
+}
+
+
+/* Record an OP_NACK from ip. */
+void peer_nack(word32 ip)
+{
+   PEERSCORE *pp;
+
+   pp = peer_find(ip, 1);
+   if(pp == NULL) return;
+   pp->nack++;
+   peer_age(pp);
+}
+
+
+/* Record a bad block or protocol error from ip. */
+void peer_bad(word32 ip)
+{
+   PEERSCORE *pp;
+
+   pp = peer_find(ip, 1);
+   if(pp == NULL) return;
+   if(pp->bad < 0xffff) pp->bad++;
+   peer_age(pp);
+}
+
+
+/* Score ip: higher is better and never zero.  Speed counts by round
+ * trip time and download rate, and is scaled by the fraction of good
+ * calls.  Each bad block or protocol error quarters the score.
+ */
+word32 peer_score(word32 ip)
+{
+   PEERSCORE *pp;
+   double score;
+   word32 rtt;
+
+   pp = peer_find(ip, 0);
+   if(pp == NULL) return PEERSCALE / (PEERRTT + PEERRTT / 10);  /* unknown */
+   rtt = pp->rtt ? pp->rtt : PEERRTT;
+   /* a floor on round trip so near peers do not take all the picks */
+   score = (double) PEERSCALE / (rtt + PEERRTT / 10);
+   score *= 1.0 + (pp->rate < 4 * PEERRATE ? pp->rate : 4 * PEERRATE)
+                  / (double) PEERRATE;
+   score *= (pp->ok + 1.0) / (pp->ok + pp->fail + pp->nack + 2.0) * 2.0;
+   score /= (double) (1 << 2 * (pp->bad < 8 ? pp->bad : 8));
+   if(score < 1.0) return 1;
+   return (word32) score;
+}  /* end peer_score() */
+
+
+/* Sort list[] from best to worst score with zeros at the end.
+ * Peers with equal scores are left in random order.
+ */
+void peer_sort(word32 *list, word32 len)
+{
+   word32 score[RPLISTLEN+LPLISTLEN];
+   word32 j, k, ip, s;
+
+   if(len > RPLISTLEN+LPLISTLEN) len = RPLISTLEN+LPLISTLEN;
+   shuffle32(list, len);
+   for(j = 0; j < len; j++)
+      score[j] = list[j] ? peer_score(list[j]) : 0;
+   /* insertion sort: the lists are short */
+   for(j = 1; j < len; j++) {
+      ip = list[j];
+      s = score[j];
+      for(k = j; k > 0 && score[k - 1] < s; k--) {
+         list[k] = list[k - 1];
+         score[k] = score[k - 1];
+      }
+      list[k] = ip;
+      score[k] = s;
+   }
+}  /* end peer_sort() */
+
+
+/* Pick a peer from list[] at random, weighted by score, so that
+ * good peers are used most without leaving out the rest.
+ * Returns 0 if list[] is empty.
+ */
+word32 peer_pick(word32 *list, word32 len)
+{
+   double sum, r;
+   word32 j;
+
+   for(sum = 0, j = 0; j < len; j++)
+      if(list[j]) sum += peer_score(list[j]);
+   if(sum == 0) return 0;
+   r = sum * (rand16() / 65536.0);
+   for(j = 0; j < len; j++) {
+      if(list[j] == 0) continue;
+      r -= peer_score(list[j]);
+      if(r < 0) return list[j];
+   }
+   for(j = len; j > 0; j--)
+      if(list[j - 1]) return list[j - 1];
+   return 0;
+}  /* end peer_pick() */
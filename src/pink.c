@@ -70,6 +70,7 @@ int pinklist(word32 ip)
 {
    if(Trace)
       plog("%s pink-listed", ntoa((byte *) &ip));
+   peer_bad(ip);
 
    if(!pinklisted(ip)) {
       if(Cpinkidx >= CPINKLEN)
@@ -98,6 +99,7 @@ int lpinklist(word32 ip)
 
 int epinklist(word32 ip)
 {
+   peer_bad(ip);
    if(Epinkidx >= EPINKLEN) {
       if(Trace) plog("Epoch pink list overflow");
       Epinkidx = 0;
@@ -0,0 +1,63 @@
+/* powcache.c  Remember trailers whose proof of work was good.
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * bval2() checks the work of a new block before update() runs bval on
+ * the same file, which checks it again.  The first good check is kept
+ * in powcache.dat, in a slot picked by the hash of the whole trailer,
+ * so the second is skipped.  Any trailer that does not match its slot
+ * byte for byte in hash and difficulty is checked in full.
+ *
+ * preval() also marks a slot when every WOTS signature in the block
+ * was good and the block hashed to the trailer's bhash.  bval still
+ * hashes the block it reads, so it may then skip the signatures.
+*/
+
+
+/* Returns VEOK if bt is in powcache.dat as good work, and if sigs
+ * is non-zero, with good signatures, else VERROR.
+ */
+int pow_cached(BTRAILER *bt, int sigs)
+{
+   POWCACHE pc;
+   byte thash[HASHLEN];
+   int fd, n;
+
+   sha256((byte *) bt, sizeof(BTRAILER), thash);
+   fd = open("powcache.dat", O_RDONLY);
+   if(fd == -1) return VERROR;
+   n = pread(fd, &pc, sizeof(POWCACHE),
+             (get32(thash) % POWCACHELEN) * sizeof(POWCACHE));
+   close(fd);
+   if(n != sizeof(POWCACHE)) return VERROR;
+   if(memcmp(pc.thash, thash, HASHLEN) != 0
+      || memcmp(pc.difficulty, bt->difficulty, 4) != 0) return VERROR;
+   if(sigs && !pc.sigs) return VERROR;
+   if(Trace) plog("pow_cached(): 0x%s%s", bnum2hex(bt->bnum),
+                  sigs ? " sigs" : "");
+   return VEOK;
+}  /* end pow_cached() */
+
+
+/* Record bt as good work in powcache.dat, and if sigs is non-zero,
+ * its block as having good signatures.
+ */
+void pow_cache(BTRAILER *bt, int sigs)
+{
+   POWCACHE pc;
+   int fd;
+
+   memset(&pc, 0, sizeof(POWCACHE));
+   sha256((byte *) bt, sizeof(BTRAILER), pc.thash);
+   memcpy(pc.difficulty, bt->difficulty, 4);
+   pc.sigs = sigs ? 1 : 0;
+   fd = open("powcache.dat", O_WRONLY | O_CREAT, 0666);
+   if(fd == -1) return;
+   /* one write of one slot, so a torn slot only fails to match */
+   pwrite(fd, &pc, sizeof(POWCACHE),
+          (get32(pc.thash) % POWCACHELEN) * sizeof(POWCACHE));
+   close(fd);
+}  /* end pow_cache() */
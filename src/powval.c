@@ -0,0 +1,164 @@
+/* powval.c  Check the proof of work of many trailers on all cores.
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * The proof of work of a trailer depends only on the trailer, so a
+ * run of them, from tfile.dat or an OP_FOUND proof, is split in chunks
+ * over Powprocs children.  They post the first bad trailer each finds
+ * to shared memory, and stop when their next chunk is past the first
+ * bad one known so far.
+*/
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+int Powprocs;  /* children for pow_run(), or zero for all cores */
+
+
+/* Returns the number of children to check work on. */
+int pow_nproc(void)
+{
+   int nproc;
+
+   nproc = Powprocs ? Powprocs : sysconf(_SC_NPROCESSORS_ONLN);
+   if(nproc > MAXPOWPROCS) nproc = MAXPOWPROCS;
+   if(nproc < 1) nproc = 1;
+   return nproc;
+}
+
+
+/* Check the proof of work of bt.
+ * Neo-genesis blocks and pseudo-blocks have none.
+ * Returns VEOK if good, else VERROR.
+ */
+int pow_val(BTRAILER *bt)
+{
+   static word32 v24trigger[2] = { V24TRIGGER, 0 };
+
+   if(bt->bnum[0] == 0 || get32(bt->tcount) == 0) return VEOK;
+   if(cmp64(bt->bnum, v24trigger) > 0) {  /* v2.4 */
+      if(peach(bt, get32(bt->difficulty), NULL, 1)) return VERROR;
+   } else {  /* v2.3 and prior */
+      if(trigg_check(bt->mroot, bt->difficulty[0], bt->bnum) == NULL)
+         return VERROR;
+   }
+   return VEOK;
+}  /* end pow_val() */
+
+
+/* Check chunks j, j + nproc, ... of chunk trailers each, from list[]
+ * or if list is NULL from offset in fd, and post the index of the
+ * first bad one to first[j].
+ */
+void pow_chunks(int fd, long offset, BTRAILER *list, word32 count,
+                word32 chunk, word32 *first, int j, int nproc)
+{
+   BTRAILER buff[POWCHUNK], *bt;
+   word32 c, k, n, low;
+   int i;
+
+   for(c = j * chunk; c < count; c += nproc * chunk) {
+      for(low = count, i = 0; i < nproc; i++)
+         if(first[i] < low) low = first[i];
+      if(c >= low) break;  /* an earlier chunk has a bad one */
+      n = count - c < chunk ? count - c : chunk;
+      if(list) bt = &list[c];
+      else {
+         bt = buff;
+         if(pread(fd, bt, n * sizeof(BTRAILER),
+                  offset + (long) c * sizeof(BTRAILER))
+            != (long) (n * sizeof(BTRAILER))) {
+            first[j] = c;  /* short read fails here */
+            return;
+         }
+      }
+      for(k = 0; k < n; k++) {
+         if(pow_val(&bt[k]) != VEOK) {
+            first[j] = c + k;
+            return;
+         }
+      }
+   }
+}  /* end pow_chunks() */
+
+
+/* Check count trailers in chunks on up to Powprocs cores.
+ * Returns the index of the first bad trailer, or the count if none.
+ */
+word32 pow_run(int fd, long offset, BTRAILER *list, word32 count,
+               word32 chunk)
+{
+   word32 *first, low;
+   pid_t pid[MAXPOWPROCS];
+   int j, nproc;
+
+   nproc = pow_nproc();
+   if((word32) nproc > (count + chunk - 1) / chunk)
+      nproc = (count + chunk - 1) / chunk;
+   if(nproc < 1) nproc = 1;
+   if(nproc == 1) {
+      low = count;
+      pow_chunks(fd, offset, list, count, chunk, &low, 0, 1);
+      return low;
+   }
+   first = mmap(NULL, nproc * sizeof(word32), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if(first == MAP_FAILED) {
+      error("pow_run(): cannot map results");
+      low = count;
+      pow_chunks(fd, offset, list, count, chunk, &low, 0, 1);
+      return low;
+   }
+   for(j = 0; j < nproc; j++) first[j] = count;
+   if(Trace) plog("pow_run(): %u trailers on %d cores", count, nproc);
+
+   for(j = 0; j < nproc; j++) {
+      pid[j] = fork();
+      if(pid[j] == 0) {
+         signal(SIGTERM, SIG_DFL);
+         pow_chunks(fd, offset, list, count, chunk, first, j, nproc);
+         _exit(0);
+      }
+      if(pid[j] == -1) {
+         pid[j] = 0;
+         /* do it here */
+         pow_chunks(fd, offset, list, count, chunk, first, j, nproc);
+      }
+   }
+   for(j = 0; j < nproc; j++)
+      if(pid[j] > 0) waitpid(pid[j], NULL, 0);
+
+   for(low = count, j = 0; j < nproc; j++)
+      if(first[j] < low) low = first[j];
+   munmap(first, nproc * sizeof(word32));
+   return low;
+}  /* end pow_run() */
+
+
+/* Check the proof of work of count trailers from offset in open
+ * file fd, or all to EOF if count is zero.
+ * Returns the index of the first bad trailer, or the count if none.
+ */
+word32 pow_first(int fd, long offset, word32 count)
+{
+   struct stat st;
+
+   if(count == 0) {
+      if(fstat(fd, &st) != 0 || st.st_size < offset) return 0;
+      count = (st.st_size - offset) / sizeof(BTRAILER);
+   }
+   return pow_run(fd, offset, NULL, count, POWCHUNK);
+}
+
+
+/* Check the proof of work of count trailers in list[], one at a time
+ * on each core, since a proof is short.
+ * Returns the index of the first bad trailer, or the count if none.
+ */
+word32 pow_list(BTRAILER *list, word32 count)
+{
+   return pow_run(-1, 0, list, count, 1);
+}
@@ -11,6 +11,12 @@ int readtf(void *buff, word32 bnum, word32 count)
 {
    FILE *fp;
 
+   if(tfmap() == VEOK) {
+      if(bnum >= Ntfmap) return 0;
+      if(count > Ntfmap - bnum) count = Ntfmap - bnum;
+      memcpy(buff, &Tfmap[bnum], count * sizeof(BTRAILER));
+      return count;
+   }
    fp = fopen("tfile.dat", "rb");
    if(fp == NULL) return 0;
    if(fseek(fp, bnum * sizeof(BTRAILER), SEEK_SET)) {
@@ -62,6 +68,13 @@ int past_weight(byte *weight, word32 lownum)
    cbnum = get32(Cblocknum);
    if(lownum >= cbnum) BAIL(1);
    memcpy(weight, Weight, 32);
+   if(tfmap() == VEOK) {
+      if(cbnum >= Ntfmap) BAIL(2);
+      /* less the weight of trailers lownum+1 to cbnum */
+      multi_sub(weight, Tfsum[cbnum], weight, 32);
+      multi_add(weight, Tfsum[lownum], weight, 32);
+      return VEOK;
+   }
    for( ; cbnum > lownum; cbnum--) {
       if((cbnum & 0xff) == 0) continue;  /* skip NG blocks */
       if(readtf(&bts, cbnum, 1) != 1) BAIL(2);
@@ -76,6 +89,8 @@ bail:
 
 
 #define INVALID_DIFF 256
+/* stop the proof trailers check at error m */
+#define PROOFBAD(m) { message = m; break; }
 
 /* Check the proof given from peer's tfile.dat in an OP_FOUND message.
  * Return VEOK to run syncup(), else error code to ignore peer.
@@ -86,7 +101,7 @@ int checkproof(TX *tx, word32 *splitblock)
 {
    int j, count, message;
    BTRAILER *bt, bts;
-   word32 diff, stime, s, time0, now, difficulty, highblock, prevnum;
+   word32 diff, stime, s, time0, now, difficulty, highblock, prevnum, bad;
    static word32 tnum[2];
    static word32 v24trigger[2] = { V24TRIGGER, 0 };
    byte weight[32];
@@ -111,7 +126,10 @@ int checkproof(TX *tx, word32 *splitblock)
    /* Compute our weight at their low block number less one. */
    if(past_weight(weight, tnum[0] - 1) != VEOK) BAIL(2);
 
-   /* Verify peer's proof trailers in OP_FOUND TX. */
+   /* Verify peer's proof trailers in OP_FOUND TX,
+    * all but their proof of work.
+    */
+   message = 0;
    diff = INVALID_DIFF;
    now = time(NULL);
    prevnum = highblock - 1;
@@ -119,39 +137,42 @@ int checkproof(TX *tx, word32 *splitblock)
    for(j = 0; j < NTFTX; j++, bt++) {
       tnum[0] = get32(bt->bnum);  /* get trailer block number */
       /* check tfile bnum sequence */
-      if(tnum[0] != prevnum + 1) BAIL(3);
+      if(tnum[0] != prevnum + 1) PROOFBAD(3);
       prevnum = tnum[0];
       stime = get32(bt->stime);
       time0 = get32(bt->time0);
       difficulty = get32(bt->difficulty);
-      if(difficulty > 255) BAIL(4);
-      if(stime <= time0) BAIL(5);  /* bad solve time sequence */
-      if(stime > (now + BCONFREQ)) BAIL(6);  /* a future block is bad */
-      if(j != 0 && memcmp(bt->phash, (bt - 1)->bhash, HASHLEN)) BAIL(7);
+      if(difficulty > 255) PROOFBAD(4);
+      if(stime <= time0) PROOFBAD(5);  /* bad solve time sequence */
+      if(stime > (now + BCONFREQ)) PROOFBAD(6);  /* a future block is bad */
+      if(j != 0 && memcmp(bt->phash, (bt - 1)->bhash, HASHLEN)) PROOFBAD(7);
       if(bt->bnum[0] == 0) continue;  /* skip NG block */
       if(diff != INVALID_DIFF) {
-         if(difficulty != diff) BAIL(8);  /* bad difficulty sequence */
+         if(difficulty != diff) PROOFBAD(8);  /* bad difficulty sequence */
       }
       if(j != 0) {
          /* stime must increase */
-         if(stime <= (s = get32((bt - 1)->stime))) BAIL(9);
-         if(time0 != s) BAIL(10);  /* time0 must == the previous stime */
-      }
-      if(get32(bt->tcount) != 0) {
-         /* bt is not a pseudoblock so check work: */
-         if(cmp64(bt->bnum, v24trigger) > 0) {  /* v2.4 */
-            if(peach(bt, difficulty, NULL, 1)) BAIL(11);
-         } else {  /* v2.3 and prior */
-            if(trigg_check(bt->mroot, difficulty, bt->bnum) == NULL) BAIL(12);
-         }
+         if(stime <= (s = get32((bt - 1)->stime))) PROOFBAD(9);
+         if(time0 != s) PROOFBAD(10);  /* time0 must == the previous stime */
       }
       add_weight2(weight, difficulty);  /* tally peer's chain weight */
       /* Compute diff = next difficulty to check next peer trailer. */
       diff = set_difficulty(difficulty, stime - time0, stime,
                             (byte *) tnum);
-      if(!Running) BAIL(13);
+      if(!Running) PROOFBAD(13);
    }  /* end for j, bt -- proof trailers check */
 
+   /* Now check work on all cores in the trailers before any error.
+    * pow_val() skips NG blocks and pseudoblocks as above.
+    */
+   bad = pow_list((BTRAILER *) TRANBUFF(tx), j);
+   if(bad < (word32) j) {
+      bt = (BTRAILER *) TRANBUFF(tx) + bad;
+      if(cmp64(bt->bnum, v24trigger) > 0) BAIL(11);  /* v2.4 */
+      BAIL(12);  /* v2.3 and prior */
+   }
+   if(message) goto bail;
+
    if(memcmp(weight, tx->weight, 32)) BAIL(14);  /* their weight is bad */
 
    /* Scan through trailer array to find where chain splits: splitblock */
@@ -9,8 +9,29 @@
 
 void close_extra(void);
 int write_data(void *buff, int len, char *fname);
+int tx_paylen(TX *tx);
+
+/* Source file: peer.c */
+int peer_init(void);
+int peer_save(void);
+PEERSCORE *peer_find(word32 ip, int add);
+void peer_age(PEERSCORE *pp);
+void peer_rtt(word32 ip, word32 ms);
+void peer_rate(word32 ip, long len, word32 ms);
+void peer_fail(word32 ip);
+void peer_nack(word32 ip);
+void peer_bad(word32 ip);
+word32 peer_score(word32 ip);
+void peer_sort(word32 *list, word32 len);
+word32 peer_pick(word32 *list, word32 len);
+
+/* Source file: limit.c */
+void refill(BUCKET *bp, word32 rate, word32 burst, word32 now);
+BUCKET *ipbucket(word32 ip, word32 now);
+int tx_admit(word32 ip);
 
 /* Source file: update.c */
+pid_t found1(word32 ip, TX *tx);
 int send_found(void);
 int update(char *fname, int mode);
 
@@ -18,31 +39,67 @@ int update(char *fname, int mode);
 int freeslot(NODE *np);
 int sendtx(NODE *np);
 int send_op(NODE *np, int opcode);
-int gettx(NODE *np, SOCKET sd);
+int txseen(byte *tx_id, int add);
+int gettx(PENDING *pp);
+int op_class(int opcode);
+int dispatch(NODE *np);
 NODE *getslot(NODE *np);
 
 /* Source file: execute.c */
 int process_tx(NODE *np);
 int sendnack(NODE *np);
+int send_fd(NODE *np, int fd, long offset, long length);
+void send_begin(NODE *np);
+int send_add(NODE *np, void *buff, long len);
+int send_end(NODE *np);
+int send_part(NODE *np, char *fname, long offset, long length);
 int send_file(NODE *np, char *fname);
+int send_range(NODE *np);
+int send_blocks(NODE *np);
+int send_compact(NODE *np);
+int send_txs(NODE *np);
+int send_balances(NODE *np);
 int send_ipl(NODE *np);
 int execute(NODE *np);
 int identify(NODE *np);
 
+int rx_nowait(NODE *np, int *got, int checkids);
 int rx2(NODE *np, int checkids, int seconds);
 int callserver(NODE *np, word32 ip);
 int get_tx2(NODE *np, word32 ip, word16 opcode);
+int check_bhash(char *fname, byte *bnum);
 int get_block2(word32 ip, byte *bnum, char *fname, word16 opcode);
+int get_tf(word32 ip, word32 first, word32 count, BTRAILER *buff);
+int recv_file(NODE *np, FILE *fp);
+int get_compact(word32 ip, byte *bnum, char *fname);
+int get_blocks(word32 ip, byte *bnum, word32 count, int fd);
+int fetch_want(int fd, byte *want, int block);
+int fetch_blocks(FETCH *fe, word32 ip, byte *bnum);
+void fetch_close(FETCH *fe);
+int fetch_wait(FETCH *fe, byte *bnum, char *fname);
+void fetch_end(FETCH *fe, byte *bnum);
 
 /* Source file: init.c */
+int add_ipl(TX *tx);
 int get_ipl(NODE *np, word32 ip);
+int get_ipls(word32 *list, int count, int want, TX *tx, word32 *ip);
 int read_coreipl(char *fname);
 int read_localipl(char *fname);
 word32 init_coreipl(NODE *np, char *fname);
 void add_weight(byte *weight, int difficulty, byte *bnum);
 int cmp_weight(byte *w1, byte *w2);
 int append_tfile(char *fname, char *tfile);
+int tfinit(TFSTATE *tsp);
+int tfserial(FILE *fp, TFSTATE *tsp, word32 count, int weight_only,
+             word32 badpow, word32 *np);
+int tfval2(FILE *fp, TFSTATE *tsp, word32 count, int weight_only);
+int tfhash_add(FILE *fp, word32 count, SHA256_CTX *ctx);
+int tfhash(FILE *fp, word32 count, byte *hash);
+void tfcheck_keep(TFSTATE *tsp, SHA256_CTX *ctx);
 byte *tfval(char *fname, byte *highblock, int weight_only, int *result);
+int tfcheck_save(int rescan);
+byte *tfresume(char *fname, byte *highblock, int *result);
+byte *tfdelta(word32 ip, byte *highbnum, byte *highblock, int *result);
 int get_eon(NODE *np, word32 peerip);
 int init(void);
 void trigg_solve(byte *link, int diff, byte *bnum);
@@ -54,16 +111,51 @@ void add_weight2(byte *weight, byte difficulty);
 void stop_mirror(void);
 int send_balance(NODE *np);
 
+/* Source file: query.c */
+int query_snap(void);
+int query_answer(NODE *np);
+int query_init(void);
+int query_pass(NODE *np);
+void stop_query(void);
+
 /* Source file: optf.c */
 int send_tf(NODE *np);
 int send_hash(NODE *np);
 
+/* Source file: powcache.c */
+int pow_cached(BTRAILER *bt, int sigs);
+void pow_cache(BTRAILER *bt, int sigs);
+
+/* Source file: powval.c */
+int pow_nproc(void);
+int pow_val(BTRAILER *bt);
+word32 pow_run(int fd, long offset, BTRAILER *list, word32 count,
+               word32 chunk);
+word32 pow_first(int fd, long offset, word32 count);
+word32 pow_list(BTRAILER *list, word32 count);
+
+/* Source file: chkpoint.c */
+int hex2hash(byte *hash, char *hex);
+CHECKPOINT *checkpt_find(word32 bnum);
+int read_checkpt(char *fname);
+int init_checkpt(char *fname);
+int checkpt_bad(BTRAILER *bt);
+word32 checkpt_skip(FILE *fp, word32 first, word32 count);
+
+/* Source file: tfmap.c */
+void tfunmap(void);
+int tfmap(void);
+
 /* Source file: proof.c */
 int readtf(void *buff, word32 bnum, word32 count);
 int loadproof(TX *tx);
 int checkproof(TX *tx, word32 *matchblock);
 
 /* Source file: syncup.c */
+int rmfiles(char *dir, char *ext);
+int mvfiles(char *from, char *to);
+int linkfile(char *from, char *to);
+int undo_ledger(word32 low, word32 high);
 int syncup(word32 matchblock, byte *txcblock, word32 peerip);
 
 /* Source file: renew.c */
@@ -0,0 +1,287 @@
+/* query.c  Pre-forked workers for OP_BALANCE and OP_RESOLVE.
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * The server passes a query socket and its NODE to a worker over a
+ * SOCK_SEQPACKET socket pair, so that lookups do not hold up the
+ * main loop.  The NODE comes with the current block number, hashes,
+ * and weight for the reply header, since the worker was forked long
+ * before.  Each worker answers from a read-only map of ledger.dat
+ * with a sorted tag index.  Every writer of ledger.dat, bup and
+ * extract() in syncup() and get_eon(), renames a whole new file into
+ * place, so an old map stays whole until the worker maps the new one.
+*/
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+pid_t Qpid[QUERYPROCS];  /* query workers */
+int Queryprocs = QUERYPROCS;
+SOCKET Qsd = INVALID_SOCKET;  /* server end of socket pair */
+word32 Nqueries;     /* queries passed to workers */
+
+/* worker ledger snapshot */
+LENTRY *Qledger;
+word32 Nqledger;
+word32 *Qtagidx;     /* ledger indexes of tagged entries sorted by tag */
+word32 Nqtagidx;
+struct stat Qstat;   /* of the mapped ledger.dat */
+
+
+int qtagcmp(const void *a, const void *b)
+{
+   return memcmp(ADDR_TAG_PTR(Qledger[*((word32 *) a)].addr),
+                 ADDR_TAG_PTR(Qledger[*((word32 *) b)].addr),
+                 ADDR_TAG_LEN);
+}
+
+
+/* Map ledger.dat again if it is not the file we have mapped.
+ * Returns VEOK if there is a snapshot to use, else VERROR.
+ */
+int query_snap(void)
+{
+   struct stat st;
+   LENTRY *lp;
+   word32 *tp, j, n;
+   int fd;
+
+   if(stat("ledger.dat", &st) != 0)
+      return Qledger ? VEOK : VERROR;  /* between unlink and rename */
+   if(Qledger && st.st_ino == Qstat.st_ino && st.st_size == Qstat.st_size
+      && st.st_mtime == Qstat.st_mtime) return VEOK;
+
+   fd = open("ledger.dat", O_RDONLY);
+   if(fd == -1) return Qledger ? VEOK : VERROR;
+   if(fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(LENTRY)
+      || (st.st_size % sizeof(LENTRY)) != 0) {
+      close(fd);
+      return Qledger ? VEOK : VERROR;
+   }
+   lp = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if(lp == MAP_FAILED) return Qledger ? VEOK : VERROR;
+   n = st.st_size / sizeof(LENTRY);
+   tp = malloc(n * sizeof(word32));
+   if(tp == NULL) {
+      munmap(lp, st.st_size);
+      return Qledger ? VEOK : VERROR;
+   }
+
+   if(Qledger) munmap(Qledger, Qstat.st_size);
+   if(Qtagidx) free(Qtagidx);
+   Qledger = lp;
+   Nqledger = n;
+   Qstat = st;
+   Qtagidx = tp;
+   for(Nqtagidx = j = 0; j < n; j++)
+      if(HAS_TAG(lp[j].addr)) tp[Nqtagidx++] = j;
+   qsort(Qtagidx, Nqtagidx, sizeof(word32), qtagcmp);
+   if(Trace) plog("query_snap(): %u entries %u tags", Nqledger, Nqtagidx);
+   return VEOK;
+}  /* end query_snap() */
+
+
+/* Binary search the snapshot for addr as le_find() does.
+ * Returns the entry or NULL if not found.
+ */
+LENTRY *query_find(byte *addr, int mode)
+{
+   long cond, mid, hi, low;
+   size_t addrlen;
+
+   if(mode == 1) addrlen = TXADDRLEN-12; else addrlen = TXADDRLEN;
+   for(low = 0, hi = Nqledger - 1; low <= hi; ) {
+      mid = (hi + low) / 2;
+      cond = memcmp(addr, Qledger[mid].addr, addrlen);
+      if(cond == 0) return &Qledger[mid];
+      if(cond < 0) hi = mid - 1; else low = mid + 1;
+   }
+   return NULL;
+}
+
+
+/* Find the entry with the tag of addr in the snapshot, or NULL. */
+LENTRY *query_tag(byte *addr)
+{
+   long cond, mid, hi, low;
+
+   for(low = 0, hi = (long) Nqtagidx - 1; low <= hi; ) {
+      mid = (hi + low) / 2;
+      cond = memcmp(ADDR_TAG_PTR(addr),
+                    ADDR_TAG_PTR(Qledger[Qtagidx[mid]].addr), ADDR_TAG_LEN);
+      if(cond == 0) return &Qledger[Qtagidx[mid]];
+      if(cond < 0) hi = mid - 1; else low = mid + 1;
+   }
+   return NULL;
+}
+
+
+/* Answer OP_BALANCE or OP_RESOLVE in np as send_balance()
+ * and tag_resolve() do, but from the snapshot.
+ */
+int query_answer(NODE *np)
+{
+   LENTRY *lp;
+   static byte zeros[8];
+
+   put64(np->tx.send_total, zeros);
+   if(np->opcode == OP_RESOLVE) {
+      lp = query_tag(np->tx.dst_addr);
+      if(lp != NULL) {
+         memcpy(np->tx.dst_addr, lp->addr, TXADDRLEN);
+         memcpy(np->tx.change_total, lp->balance, TXAMOUNT);
+         put64(np->tx.send_total, One);
+      }
+      return send_op(np, OP_RESOLVE);
+   }
+   if(((byte *) (np->tx.src_addr))[2196] == 0x00) {
+      /* zeroed tag: find address without matching the tag */
+      lp = query_find(np->tx.src_addr, 1);
+      if(lp != NULL) memcpy(np->tx.src_addr, lp->addr, TXADDRLEN);
+   } else lp = query_find(np->tx.src_addr, 0);
+   if(lp != NULL) put64(np->tx.send_total, lp->balance);
+   return send_op(np, OP_SEND_BAL);
+}  /* end query_answer() */
+
+
+/* Take NODE's and their sockets from the server on sd until she
+ * is gone.  -- in worker
+ */
+void query_worker(SOCKET sd, pid_t ppid)
+{
+   QUERYMSG qm;
+   struct msghdr msg;
+   struct iovec iov;
+   struct cmsghdr *cmsg;
+   char cbuf[CMSG_SPACE(sizeof(int))];
+   int n;
+
+   signal(SIGTERM, SIG_DFL);  /* for stop_query() */
+   signal(SIGINT, SIG_IGN);
+   show("query");
+   for(;;) {
+      if(getppid() != ppid) break;
+      n = waitsock(sd, POLLIN, mtime() + 1000);
+      if(n == 0) continue;
+      if(n < 0) break;
+      memset(&msg, 0, sizeof(msg));
+      iov.iov_base = &qm;
+      iov.iov_len = sizeof(QUERYMSG);
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = cbuf;
+      msg.msg_controllen = sizeof(cbuf);
+      n = recvmsg(sd, &msg, 0);
+      if(n == 0) break;  /* server closed her end */
+      cmsg = CMSG_FIRSTHDR(&msg);
+      if(cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET
+         || cmsg->cmsg_type != SCM_RIGHTS) continue;  /* no socket */
+      memcpy(&qm.node.sd, CMSG_DATA(cmsg), sizeof(int));
+      if(n != sizeof(QUERYMSG)) {
+         closesocket(qm.node.sd);  /* do not keep what came with it */
+         continue;
+      }
+      /* sendtx() puts these in the reply */
+      put64(Cblocknum, qm.cblock);
+      memcpy(Cblockhash, qm.cblockhash, HASHLEN);
+      memcpy(Prevhash, qm.pblockhash, HASHLEN);
+      memcpy(Weight, qm.weight, HASHLEN);
+      if(query_snap() == VEOK) query_answer(&qm.node);
+      closesocket(qm.node.sd);
+   }
+   exit(0);
+}  /* end query_worker() */
+
+
+/* Start the query workers.  -- called by server() */
+int query_init(void)
+{
+   SOCKET sv[2];
+   pid_t ppid;
+   int j;
+
+   if(Queryprocs < 1) return VEOK;  /* answer in server() */
+   if(Queryprocs > QUERYPROCS) Queryprocs = QUERYPROCS;
+   if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0)
+      return error("query_init(): socketpair()");
+   ppid = getpid();
+   for(j = 0; j < Queryprocs; j++) {
+      Qpid[j] = fork();
+      if(Qpid[j] == 0) {
+         close(sv[0]);
+         query_worker(sv[1], ppid);
+      }
+      if(Qpid[j] == -1) {
+         Qpid[j] = 0;
+         error("query_init(): fork()");
+         break;
+      }
+   }
+   close(sv[1]);
+   if(j == 0) {
+      close(sv[0]);
+      return VERROR;
+   }
+   Qsd = sv[0];
+   nonblock(Qsd);  /* a full queue is answered in server() */
+   return VEOK;
+}  /* end query_init() */
+
+
+/* Pass OP_BALANCE or OP_RESOLVE in np to a worker.
+ * Returns VEOK if sent, else VERROR to answer it here.
+ * -- in parent, called by dispatch()
+ */
+int query_pass(NODE *np)
+{
+   static QUERYMSG qm;
+   struct msghdr msg;
+   struct iovec iov;
+   struct cmsghdr *cmsg;
+   char cbuf[CMSG_SPACE(sizeof(int))];
+
+   if(Qsd == INVALID_SOCKET) return VERROR;
+   memcpy(&qm.node, np, sizeof(NODE));
+   put64(qm.cblock, Cblocknum);
+   memcpy(qm.cblockhash, Cblockhash, HASHLEN);
+   memcpy(qm.pblockhash, Prevhash, HASHLEN);
+   memcpy(qm.weight, Weight, HASHLEN);
+   memset(&msg, 0, sizeof(msg));
+   memset(cbuf, 0, sizeof(cbuf));
+   iov.iov_base = &qm;
+   iov.iov_len = sizeof(QUERYMSG);
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = cbuf;
+   msg.msg_controllen = sizeof(cbuf);
+   cmsg = CMSG_FIRSTHDR(&msg);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+   memcpy(CMSG_DATA(cmsg), &np->sd, sizeof(int));
+   if(sendmsg(Qsd, &msg, 0) != sizeof(QUERYMSG)) return VERROR;
+   Nqueries++;
+   return VEOK;
+}  /* end query_pass() */
+
+
+/* Stop the query workers. */
+void stop_query(void)
+{
+   int j;
+
+   if(Qsd != INVALID_SOCKET) {
+      closesocket(Qsd);
+      Qsd = INVALID_SOCKET;
+   }
+   for(j = 0; j < QUERYPROCS; j++) {
+      if(Qpid[j] == 0) continue;
+      kill(Qpid[j], SIGTERM);
+      waitpid(Qpid[j], NULL, 0);
+      Qpid[j] = 0;
+   }
+}  /* end stop_query() */
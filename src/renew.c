@@ -61,12 +61,11 @@ bail:
 int refresh_ipl(void)
 {
    NODE node;
-   int j, message = 0;
+   int message = 0;
    word32 ip;
    TX tx;
 
-   for(j = ip = 0; j < 1000 && ip == 0; j++)
-      ip = Rplist[rand16() % RPLISTLEN];
+   ip = peer_pick(Rplist, RPLISTLEN);
    if(ip == 0) BAIL(1);
    if(get_ipl(&node, ip) != VEOK) BAIL(2);
    /* Check peer's chain weight against ours. */
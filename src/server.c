@@ -9,6 +9,33 @@
 */
 
 
+/* Close a Pending[] socket and free its slot. */
+void unpend(PENDING *pp)
+{
+   if(pp->pri >= 0) Qdepth[pp->pri]--;
+   if(pp->node.sd != INVALID_SOCKET) closesocket(pp->node.sd);
+   pp->node.sd = INVALID_SOCKET;
+   pp->pri = -1;
+}
+
+
+/* Return the request that waited longest in the best class,
+ * or NULL if none is queued.
+ */
+PENDING *nextpend(void)
+{
+   PENDING *pp, *best;
+
+   best = NULL;
+   for(pp = Pending; pp < &Pending[PENDLEN]; pp++) {
+      if(pp->node.sd == INVALID_SOCKET || pp->pri < 0) continue;
+      if(best == NULL || pp->pri < best->pri
+         || (pp->pri == best->pri && pp->time < best->time)) best = pp;
+   }
+   return best;
+}
+
+
 /**
  * The Mochimo Server/Client!
  *
@@ -16,11 +43,12 @@
  */
 int server(void)
 {
-   static time_t nsd_time;  /* event timers */
-   static time_t bctime, mwtime, mqtime, sftime, vtime;
+   static time_t bctime, mwtime, mqtime, sftime, vtime;  /* event timers */
    static time_t ipltime;
    static SOCKET lsd, nsd;
-   static NODE *np, node;
+   static NODE *np;
+   static PENDING *pp;
+   static int pri;
    static struct sockaddr_in addr;
    static int status;   /* child return status */
    static pid_t pid;    /* child pid */
@@ -62,7 +90,8 @@ int server(void)
    if(nonblock(lsd) == -1)
       fatal("nonblock() failed on lsd.");
    listen(lsd, LQLEN);  /* LQSIZ */
-   nsd = INVALID_SOCKET;
+   for(pp = Pending; pp < &Pending[PENDLEN]; pp++)
+      pp->node.sd = INVALID_SOCKET;
 
    if(Safemode && !iszero(Cblocknum, 8)) {
       plog("Safemode");
@@ -70,6 +99,8 @@ int server(void)
    }
    else plog("Listening...");
 
+   query_init();  /* start OP_BALANCE and OP_RESOLVE workers */
+
    unlink("vstart.lck");  /* signal Verisimility that we are up. */
 
    /*
@@ -107,7 +138,9 @@ int server(void)
                Blockfound = 0;
             }
          }  /* end if OP_FOUND child */
-         else if(np->opcode == OP_GETBLOCK || np->opcode == OP_GET_TFILE) {
+         else if(np->opcode == OP_GETBLOCK || np->opcode == OP_GETBLOCKS
+                 || np->opcode == OP_GET_RANGE || np->opcode == OP_GET_TFILE
+                 || np->opcode == OP_GETCOMPACT) {
             if(get16(np->tx.len) == 0 && status == 0) {
                addcurrent(np->src_ip);  /* v.28 */
                addrecent(np->src_ip);
@@ -121,56 +154,78 @@ int server(void)
          if(pid > 0) Sendfound_pid = 0;
       }
 
-      /* Check for new connection with accept() and set nsd. */
-      if(nsd == INVALID_SOCKET) {
-         if((nsd = accept(lsd, NULL, NULL)) != INVALID_SOCKET) {
-            nonblock(nsd);
-            nsd_time = Ltime;
-         }
+      /* Accept new connections while Pending[] has room. */
+      for(pp = Pending; pp < &Pending[PENDLEN]; pp++) {
+         if(pp->node.sd != INVALID_SOCKET) continue;
+         if((nsd = accept(lsd, NULL, NULL)) == INVALID_SOCKET) break;
+         nonblock(nsd);
+         pp->node.sd = nsd;
+         pp->time = Ltime;
+         pp->pri = -1;
+         pp->step = 0;
       }
 
       /*
-       * If accept() good,
-       * try to read data from socket, nsd, using gettx().
+       * Read requests with gettx() and queue them by class,
+       * or drop them if they wait too long.
        */
-      if(nsd != INVALID_SOCKET) {
+      for(pp = Pending; pp < &Pending[PENDLEN]; pp++) {
+         if(pp->node.sd == INVALID_SOCKET) continue;
+         if(pp->pri >= 0) {
+            if(Ltime - pp->time <= INIT_TIMEOUT) continue;
+            Ntimeouts++;  /* she gave up on us by now */
+            unpend(pp);
+            continue;
+         }
          /* gettx() completes the initial handshake and fills node
-          * and some parent tables.  It returns -1 if no data yet.
-          * If gettx() completes the transaction, it returns 0, 1, 2, or 3;
-          * otherwise it returns sizeof(TX) and needs help from child
-          * so getslot() allocates a new np and copies node into it.
+          * and some parent tables, a step at a time as data arrives.
+          * It returns -1 if no data yet, sizeof(TX) when the request
+          * is read, or 1, 2 if done.
           */
-         status = gettx(&node, nsd);  /* fills in node */
-         if(status != -1) {
-            if(status == sizeof(TX) && (np = getslot(&node)) != NULL) {
-               pid = fork();  /* create child to handle TX */
-               if(pid == 0) {
-                  /* in child */
-                  exit(execute(np));  /* parent calls waitpid() for status */
-               }
-               /* parent puts valid child pid in parent table */
-               if(pid != -1) np->pid = pid;
-               else {
-                  /* fork() failed so freeslot() removes child data from
-                   * parent Node[] table.
-                   */
-                  freeslot(np);
-                  error("fork() failed!");
-                  restart("cannot fork()");
-               }
-            }  /* end if need child and slot found */
-            /* parent closes its socket if gettx() did not */
-            if(node.sd != INVALID_SOCKET)
-               closesocket(nsd);
-            nsd = INVALID_SOCKET;
-         } else {   /* status == -1 no data yet -- so check timeout */
-            if(Ltime - nsd_time > INIT_TIMEOUT) {
+         status = gettx(pp);
+         if(status == -1) {  /* no data yet -- so check timeout */
+            if(Ltime - pp->time > INIT_TIMEOUT) {
                Ntimeouts++;  /* log statistics */
-               closesocket(nsd);
-               nsd = INVALID_SOCKET;
+               unpend(pp);
             }
-         }  /* end if timeout */
-      }  /* endif nsd valid */
+            continue;
+         }
+         if(status != sizeof(TX)) { unpend(pp); continue; }
+         pp->pri = op_class(pp->node.opcode);
+         if(++Qdepth[pp->pri] > Qmax[pp->pri]) Qmax[pp->pri] = Qdepth[pp->pri];
+      }
+
+      /*
+       * Serve queued requests in order of class.  All found blocks,
+       * sync and TX go now, but only one query per loop so that new
+       * arrivals are read first.
+       */
+      while((pp = nextpend()) != NULL) {
+         pri = pp->pri;
+         /* dispatch() returns sizeof(TX) if the request needs a child,
+          * so getslot() allocates a new np and copies node into it.
+          */
+         status = dispatch(&pp->node);
+         if(status == sizeof(TX) && (np = getslot(&pp->node)) != NULL) {
+            pid = fork();  /* create child to handle TX */
+            if(pid == 0) {
+               /* in child */
+               exit(execute(np));  /* parent calls waitpid() for status */
+            }
+            /* parent puts valid child pid in parent table */
+            if(pid != -1) np->pid = pid;
+            else {
+               /* fork() failed so freeslot() removes child data from
+                * parent Node[] table.
+                */
+               freeslot(np);
+               error("fork() failed!");
+               restart("cannot fork()");
+            }
+         }  /* end if need child and slot found */
+         unpend(pp);  /* parent closes its socket */
+         if(pri == PRI_QUERY) break;
+      }
 
       Ngen++;  /* loop counter */
 
@@ -290,6 +345,9 @@ int server(void)
          vtime += 4;
       }
 
+      /* checkpoint tfile validation for the next init() */
+      if(get32(Cblocknum) >= Tfcheckblock + TFCHECKFREQ) tfcheck_save(0);
+
       if(Ltime >= ipltime) {
          refresh_ipl();  /* refresh ip list */
          ipltime = Ltime + (rand2() % 300) + 10;
@@ -303,12 +361,16 @@ int server(void)
 
 
       /* dynamic sleep function */
-      if(Dynasleep != 0 && Nonline < 1) usleep(Dynasleep);
+      if(Dynasleep != 0 && Nonline < 1
+         && Qdepth[PRI_FOUND] + Qdepth[PRI_SYNC] + Qdepth[PRI_QUERY] == 0)
+         usleep(Dynasleep);
 
    } /* end while(Running) */
    /*
     * Clean up server and exit
     */
    closesocket(lsd);  /* close listening socket */
+   for(pp = Pending; pp < &Pending[PENDLEN]; pp++)
+      if(pp->node.sd != INVALID_SOCKET) unpend(pp);
    return 0;          /* main() will finish cleanup */
 } /* end server() */
@@ -17,6 +17,34 @@ int nonblock(SOCKET sd)
    return ioctlsocket(sd, FIONBIO, (u_long FAR *) &arg);
 }
 
+/* Milliseconds on a clock that is never set back, for deadlines */
+word32 mtime(void)
+{
+   return GetTickCount();
+}
+
+/* Wait until sd is ready for events (POLLIN or POLLOUT) or until
+ * deadline from mtime().
+ * Returns 1 if ready, 0 at the deadline, or -1 on error.
+ */
+int waitsock(SOCKET sd, int events, word32 deadline)
+{
+   fd_set fds;
+   struct timeval tv;
+   int ms, n;
+
+   ms = (int) (deadline - mtime());
+   if(ms <= 0) return 0;
+   FD_ZERO(&fds);
+   FD_SET(sd, &fds);
+   tv.tv_sec = ms / 1000;
+   tv.tv_usec = (ms % 1000) * 1000;
+   if(events & POLLIN) n = select(0, &fds, NULL, NULL, &tv);
+   else n = select(0, NULL, &fds, NULL, &tv);
+   if(n < 0) return -1;
+   return n ? 1 : 0;
+}
+
 #else
 #include <fcntl.h>
 
@@ -42,6 +70,38 @@ int blocking(SOCKET sd)
    return fcntl(sd, F_SETFL, flags & (~O_NONBLOCK));
 }
 
+/* Milliseconds on a clock that is never set back, for deadlines.
+ * Wraps in about 49 days, so only compare differences.
+ */
+word32 mtime(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (word32) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Sleep in poll() until sd is ready for events (POLLIN or POLLOUT)
+ * or until deadline from mtime().  A signal does not end the wait.
+ * Returns 1 if ready (or hung up), 0 at the deadline, or -1 on error.
+ */
+int waitsock(SOCKET sd, int events, word32 deadline)
+{
+   struct pollfd pfd;
+   int ms, n;
+
+   pfd.fd = sd;
+   pfd.events = events;
+   for(;;) {
+      ms = (int) (deadline - mtime());
+      if(ms <= 0) return 0;
+      n = poll(&pfd, 1, ms);
+      if(n > 0) return 1;
+      if(n == 0) return 0;
+      if(errno != EINTR) return -1;
+   }
+}
+
 #endif
 
 
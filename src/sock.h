@@ -16,11 +16,14 @@
 #define EALREADY     WSAEALREADY 
 #define EWOULDBLOCK  WSAEWOULDBLOCK
 #define getsockerr() WSAGetLastError()
+#define POLLIN       1     /* for waitsock() */
+#define POLLOUT      4
 #else
 #include <fcntl.h>
 #include <sys/socket.h>           /* for Unix sockets */
 #include <netdb.h>
 #include <sys/time.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/nameser.h>
 #include <arpa/inet.h>
@@ -7,6 +7,225 @@
  *
 */
 
+#include <dirent.h>
+
+
+/* Unlink the files in dir whose names end in ext, or all if ext is NULL.
+ * Returns VEOK on success, else VERROR.
+ */
+int rmfiles(char *dir, char *ext)
+{
+   DIR *dp;
+   struct dirent *de;
+   char fname[256];
+   int len, ecode = VEOK;
+
+   dp = opendir(dir);
+   if(dp == NULL) return error("rmfiles(): cannot open %s", dir);
+   while((de = readdir(dp)) != NULL) {
+      if(de->d_name[0] == '.') continue;
+      len = strlen(de->d_name);
+      if(ext && ((size_t) len < strlen(ext)
+                 || strcmp(&de->d_name[len - strlen(ext)], ext) != 0))
+         continue;
+      sprintf(fname, "%.100s/%.100s", dir, de->d_name);
+      if(unlink(fname) != 0) ecode = error("rmfiles(): cannot unlink %s", fname);
+   }
+   closedir(dp);
+   return ecode;
+}  /* end rmfiles() */
+
+
+/* Move the files in dir from to dir to with rename().
+ * Returns VEOK on success, else VERROR.
+ */
+int mvfiles(char *from, char *to)
+{
+   DIR *dp;
+   struct dirent *de;
+   char fname[256], tname[256];
+   int ecode = VEOK;
+
+   dp = opendir(from);
+   if(dp == NULL) return error("mvfiles(): cannot open %s", from);
+   while((de = readdir(dp)) != NULL) {
+      if(de->d_name[0] == '.') continue;
+      sprintf(fname, "%.100s/%.100s", from, de->d_name);
+      sprintf(tname, "%.100s/%.100s", to, de->d_name);
+      if(rename(fname, tname) != 0)
+         ecode = error("mvfiles(): cannot move %s", fname);
+   }
+   closedir(dp);
+   return ecode;
+}  /* end mvfiles() */
+
+
+/* Make to a hard link to from, or a copy if the file system
+ * cannot link.  Files are only replaced with rename() or are
+ * appended to after trim_tfile(), so the link is a snapshot.
+ * Returns VEOK on success, else VERROR.
+ */
+int linkfile(char *from, char *to)
+{
+   char buff[4096];
+   int fd, tfd, n;
+
+   unlink(to);
+   if(link(from, to) == 0) return VEOK;
+   if(Trace) plog("linkfile(): copying %s to %s", from, to);
+   fd = open(from, O_RDONLY);
+   if(fd == -1) return error("linkfile(): cannot open %s", from);
+   tfd = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+   if(tfd == -1) {
+      close(fd);
+      return error("linkfile(): cannot create %s", to);
+   }
+   while((n = read(fd, buff, sizeof(buff))) > 0)
+      if(write(tfd, buff, n) != n) break;
+   close(fd);
+   if(close(tfd) != 0 || n != 0) {
+      unlink(to);
+      return error("linkfile(): cannot copy %s", from);
+   }
+   return VEOK;
+}  /* end linkfile() */
+
+
+/* Put fname back from split/ over any other one. */
+int unsplit(char *fname)
+{
+   char sname[64];
+
+   sprintf(sname, "split/%s", fname);
+   if(!exists(sname)) return VEOK;  /* not saved */
+   unlink(fname);  /* rename() over a link to itself does nothing */
+   if(rename(sname, fname) != 0)
+      return error("unsplit(): cannot restore %s", fname);
+   return VEOK;
+}
+
+
+/* Sort undo records by address, then oldest block first. */
+int undocmp(const void *a, const void *b)
+{
+   LUNDO *ua = *((LUNDO **) a), *ub = *((LUNDO **) b);
+   int cond;
+
+   cond = memcmp(ua->le.addr, ub->le.addr, TXADDRLEN);
+   if(cond) return cond;
+   return ua < ub ? -1 : ua > ub;  /* read oldest block first */
+}
+
+
+/* Take ledger.dat back to before block low with the undo records
+ * of blocks low to high, whose files are in split/.
+ * Returns VEOK on success, else VERROR to rebuild the ledger.
+ */
+int undo_ledger(word32 low, word32 high)
+{
+   FILE *fp, *lfp, *fpout;
+   LUNDO *undo, *up;
+   LUNDO **idx;
+   LENTRY le;
+   BTRAILER bt;
+   byte bnum[8], bhash[HASHLEN];
+   char fname[64];
+   word32 b, n, nundo, j;
+   long len;
+   int cond, leof, ecode;
+
+   if(Trace) plog("undo_ledger(0x%x, 0x%x)", low, high);
+   /* read the records of all blocks, oldest first */
+   undo = NULL;
+   nundo = 0;
+   memset(bnum, 0, 8);
+   for(b = low; b <= high; b++) {
+      put32(bnum, b);
+      sprintf(fname, "split/b%s.bc", bnum2hex(bnum));
+      if(gethdrlen(fname) == 4) continue;  /* pseudo-block */
+      if(readtrailer(&bt, fname) != VEOK) goto bad;
+      sprintf(fname, "undo/u%s.dat", bnum2hex(bnum));
+      fp = fopen(fname, "rb");
+      if(fp == NULL) goto bad;
+      fseek(fp, 0, SEEK_END);
+      len = ftell(fp) - HASHLEN;
+      fseek(fp, 0, SEEK_SET);
+      /* must be the record of this very block */
+      if(len < 0 || (len % sizeof(LUNDO)) != 0
+         || fread(bhash, 1, HASHLEN, fp) != HASHLEN
+         || memcmp(bhash, bt.bhash, HASHLEN) != 0) {
+         fclose(fp);
+         goto bad;
+      }
+      n = len / sizeof(LUNDO);
+      up = realloc(undo, (nundo + n + 1) * sizeof(LUNDO));
+      if(up == NULL) {
+         fclose(fp);
+         goto bad;
+      }
+      undo = up;
+      if(fread(&undo[nundo], sizeof(LUNDO), n, fp) != n) {
+         fclose(fp);
+         goto bad;
+      }
+      fclose(fp);
+      nundo += n;
+   }
+   idx = malloc((nundo + 1) * sizeof(LUNDO *));
+   if(idx == NULL) goto bad;
+   for(j = 0; j < nundo; j++) idx[j] = &undo[j];
+   qsort(idx, nundo, sizeof(LUNDO *), undocmp);
+
+   /* Merge the oldest record of each address into the ledger. */
+   lfp = fopen("ledger.dat", "rb");
+   fpout = fopen("ledger.tmp", "wb");
+   if(lfp == NULL || fpout == NULL) {
+      if(lfp) fclose(lfp);
+      if(fpout) fclose(fpout);
+      free(idx);
+      goto bad;
+   }
+   ecode = VEOK;
+   leof = fread(&le, 1, sizeof(LENTRY), lfp) != sizeof(LENTRY);
+   for(j = 0; j < nundo || !leof; ) {
+      if(j < nundo && j > 0
+         && memcmp(idx[j]->le.addr, idx[j - 1]->le.addr, TXADDRLEN) == 0) {
+         j++;  /* a later block changed it again */
+         continue;
+      }
+      if(j >= nundo) cond = -1;
+      else if(leof) cond = 1;
+      else cond = memcmp(le.addr, idx[j]->le.addr, TXADDRLEN);
+      if(cond < 0) {
+         /* not changed by these blocks */
+         if(fwrite(&le, 1, sizeof(LENTRY), fpout) != sizeof(LENTRY))
+            ecode = VERROR;
+      } else if(idx[j]->found) {
+         /* changed or removed: put the old entry back */
+         if(fwrite(&idx[j]->le, 1, sizeof(LENTRY), fpout) != sizeof(LENTRY))
+            ecode = VERROR;
+      }  /* else created by these blocks: drop it */
+      if(cond <= 0 && !leof)
+         leof = fread(&le, 1, sizeof(LENTRY), lfp) != sizeof(LENTRY);
+      if(cond >= 0) j++;
+   }
+   fclose(lfp);
+   if(fclose(fpout) != 0) ecode = VERROR;
+   free(idx);
+   free(undo);
+   if(ecode != VEOK || rename("ledger.tmp", "ledger.dat") != 0) {
+      unlink("ledger.tmp");
+      return error("undo_ledger(): cannot write ledger.tmp");
+   }
+   if(Trace) plog("undo_ledger(): %u records", nundo);
+   return VEOK;
+bad:
+   if(undo) free(undo);
+   if(Trace) plog("undo_ledger(): cannot undo block 0x%x", b);
+   return VERROR;
+}  /* end undo_ledger() */
+
+
 /* Pull a divergent block chain and merge it into ours
  * rather than bailing out to contention!
  * Always returns VEOK to ignore contention.
@@ -18,12 +237,16 @@ int syncup(word32 splitblock, byte *txcblock, word32 peerip)
 {
    byte bnum[8], *tfweight, saveweight[HASHLEN];
    static word32 lastneo[2], sblock[2];
-   char buff[256];
+   char buff[256], fname[256];
+   word32 high;
    int j, result;
    NODE *np2;
    time_t lasttime;
+   FETCH fe;       /* fetch_blocks() child */
 
    Insyncup = 1;
+   fe.pid = 0;
+   fe.rfd = fe.wfd = -1;
    show("syncup");
    if(Bcpid) { /* Wait for block constructor to exit... */
       if(Trace) plog("syncup(): Waiting for bcon to exit...");
@@ -56,20 +279,56 @@ int syncup(word32 splitblock, byte *txcblock, word32 peerip)
    if(Trace) plog("syncup(): beginning state save...");
    le_close(); 
 
-   /* Backup TFILE, Ledger, and blocks to split-tree directory. */
+   /* Backup TFILE, Ledger, and blocks to split-tree directory
+    * with links and renames, not copies.
+    */
    /* system("mkdir split"); * already exists */
    if(Trace) plog("syncup(): Backing up TFILE, ledger.dat, and blocks...");
-   system("rm split/*");
-   system("cp tfile.dat split");
-   system("cp ledger.dat split");
-   system("mv bc/*.bc split");
    memcpy(saveweight, Weight, HASHLEN);
+   if(rmfiles("split", NULL) != VEOK
+      || linkfile("tfile.dat", "split/tfile.dat") != VEOK
+      || linkfile("ledger.dat", "split/ledger.dat") != VEOK) {
+      if(Trace) plog("syncup(): failed!  Unable to back up state");
+      rmfiles("split", NULL);
+      le_open("ledger.dat", "rb");
+      Insyncup = 0;
+      return VEOK;
+   }
+   if(mvfiles(Bcdir, "split") != VEOK) goto badsyncup;
 
    sblock[0] = splitblock;
    /* Compute first previous NG block */
    lastneo[0] = (get32(Cblocknum) & 0xffffff00) - 256;
    if(Trace) plog("syncup(): Identified first previous NG block as %s",
                   bnum2hex((byte *) &lastneo));
+   if(Trace) plog("Split point is block %s", bnum2hex((byte *) &sblock));
+
+   /* If the split is in this aeon, undo our blocks since the split
+    * from their undo records, and keep what is before it.
+    */
+   high = get32(Cblocknum);
+   if(splitblock > (high & 0xffffff00) && splitblock <= high
+      && undo_ledger(splitblock, high) == VEOK) {
+      put64(bnum, sblock);
+      sub64(bnum, One, bnum);
+      if(trim_tfile(bnum) != VEOK) {
+         if(Trace) plog("syncup(): T-File trim failed!");
+         goto badsyncup;
+      }
+      for(put64(bnum, lastneo); cmp64(bnum, sblock) < 0; ) {
+         sprintf(buff, "split/b%s.bc", bnum2hex(bnum));
+         sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex(bnum));
+         if(exists(buff) && linkfile(buff, fname) != VEOK) goto badsyncup;
+         add64(bnum, One, bnum);
+      }
+      if(reset_difficulty(NULL, Bcdir) != VEOK) {
+         if(Trace) plog("syncup(): failed!  reset_difficulty() failed!");
+         goto badsyncup;
+      }
+      tag_free();  /* Erase Tagidx[] of the undone ledger */
+      le_open("ledger.dat", "rb");
+      goto download;
+   }
 
    /* Delete Ledger and trim T-File */
    if(unlink("ledger.dat") != 0) {
@@ -83,11 +342,10 @@ int syncup(word32 splitblock, byte *txcblock, word32 peerip)
 
    /* Extract first previous Neogenesis Block to ledger.dat */
    if(Trace) plog("syncup(): Expanding Neo-genesis block to ledger.dat...");
-   sprintf(buff, "cp split/b%s.bc bc/b%s.bc", bnum2hex((byte *) &lastneo), 
-           bnum2hex((byte *) &lastneo));
-   system(buff);
-   sprintf(buff, "bc/b%s.bc", bnum2hex((byte *) &lastneo));
-   if(extract(buff, "ledger.dat") != VEOK) {
+   sprintf(buff, "split/b%s.bc", bnum2hex((byte *) &lastneo));
+   sprintf(fname, "%s/b%s.bc", Bcdir, bnum2hex((byte *) &lastneo));
+   if(linkfile(buff, fname) != VEOK) goto badsyncup;
+   if(extract(fname, "ledger.dat") != VEOK) {
       if(Trace) plog("syncup(): failed!  Unable to extract ledger!");
       goto badsyncup;
    }
@@ -99,13 +357,12 @@ int syncup(word32 splitblock, byte *txcblock, word32 peerip)
    }
    le_open("ledger.dat", "rb");
 
-   if(Trace) plog("Split point is block %s", bnum2hex((byte *) &sblock));
    add64(lastneo, One, bnum);
    for( ;cmp64(bnum, sblock) < 0; ) {
-      if(Trace) plog("syncup(): Copying split/b%s.bc to spblock.tmp",
+      if(Trace) plog("syncup(): Linking split/b%s.bc to spblock.tmp",
                      bnum2hex(bnum));
-      sprintf(buff, "cp split/b%s.bc spblock.tmp", bnum2hex(bnum));
-      system(buff);
+      sprintf(buff, "split/b%s.bc", bnum2hex(bnum));
+      if(linkfile(buff, "spblock.tmp") != VEOK) goto badsyncup;
       if(update("spblock.tmp", 1) != VEOK) {
          if(Trace) plog("syncup(): failed to update our own block.");
          goto badsyncup;
@@ -114,19 +371,22 @@ int syncup(word32 splitblock, byte *txcblock, word32 peerip)
       if(bnum[0] == 0) add64(bnum, One, bnum);  /* skip NG blocks */
    }
 
+download:
    /* Download missing blocks from peer. */
    if(Trace) plog("Download and update missing blocks from peer...");
    put64(bnum, sblock);
    for(j = 0; ; ) {
       if(bnum[0] == 0) add64(bnum, One, bnum);  /* skip NG blocks */
-      sprintf(buff, "b%s.bc", bnum2hex(bnum));
       if(j == 60) {
-         if(Trace) plog("syncup(): failed while downloading %s from %s",
-                        buff, ntoa((byte *) &peerip));
+         if(Trace) plog("syncup(): failed while downloading b%s.bc from %s",
+                        bnum2hex(bnum), ntoa((byte *) &peerip));
          goto badsyncup;
       }
-      lasttime = time(NULL);
-      if(get_block2(peerip, bnum, buff, OP_GETBLOCK) != VEOK) {
+      if(fe.pid == 0) {
+         lasttime = time(NULL);
+         fetch_blocks(&fe, peerip, bnum);
+      }
+      if(fetch_wait(&fe, bnum, buff) != VEOK) {
          if(cmp64(bnum, txcblock) >= 0) break;  /* success */
          if(time(NULL) == lasttime) sleep(1);
          j++;  /* retry counter */
@@ -138,8 +398,11 @@ int syncup(word32 splitblock, byte *txcblock, word32 peerip)
       }
       add64(bnum, One, bnum);
    }
-   system("cp split/b0000000000000000.bc bc");
-   system("rm split/*");
+   fetch_end(&fe, bnum);
+   sprintf(fname, "%s/b0000000000000000.bc", Bcdir);
+   if(linkfile("split/b0000000000000000.bc", fname) != VEOK)
+      error("syncup(): cannot restore Genesis Block");
+   rmfiles("split", NULL);
    /* re-compute tfile weight */
    tfweight = tfval("tfile.dat", bnum, 1, &result);
    if(result) plog("syncup(): tfval() error: %d", result);
@@ -151,11 +414,13 @@ int syncup(word32 splitblock, byte *txcblock, word32 peerip)
 badsyncup:
    /* Restore block chain from saved state after a bad re-sync attempt. */
    if(Trace) plog("syncup(): bad sync: restoring saved state...");
+   fetch_end(&fe, bnum);
    le_close();
-   system("mv split/tfile.dat .");
-   system("mv split/ledger.dat .");
-   system("rm *.bc bc/*");
-   system("mv split/* bc");
+   unsplit("tfile.dat");
+   unsplit("ledger.dat");
+   rmfiles(".", ".bc");
+   rmfiles(Bcdir, NULL);
+   mvfiles("split", Bcdir);
    reset_difficulty(NULL, Bcdir);  /* reset Difficulty and others */
    memcpy(Weight, saveweight, HASHLEN);
    le_open("ledger.dat", "rb");
@@ -178,6 +178,62 @@ bail:
 }  /* end tag_find() */
 
 
+/* Resolve count tag queries in one pass over Tagidx[].
+ * q[idx[j]] for j < count are zero addresses with a tag to find,
+ * with idx[] in order of tag.  Each found query gets the full
+ * address and balance from ledger.dat; the rest are left as is.
+ * Return the number found, or -1 on error.
+ */
+int tag_findq(LENTRY *q, word32 *idx, word32 count)
+{
+   FILE *fp;
+   LENTRY le, *qp;
+   byte *tp;
+   word32 n, lo, hi, mid, left;
+   int found;
+
+   if(count == 0) return 0;
+   if(Tagidx == NULL) tag_buildidx();
+   if(Tagidx == NULL) return -1;
+   fp = fopen("ledger.dat", "rb");
+   if(fp == NULL) return -1;
+   found = 0;
+   left = count;
+   for(tp = Tagidx, n = 0; n < Ntagidx && left; n++, tp += ADDR_TAG_LEN) {
+      /* find the first query with tag tp */
+      for(lo = 0, hi = count; lo < hi; ) {
+         mid = lo + (hi - lo) / 2;
+         if(memcmp(ADDR_TAG_PTR(q[idx[mid]].addr), tp, ADDR_TAG_LEN) < 0)
+            lo = mid + 1;
+         else hi = mid;
+      }
+      if(lo >= count
+         || memcmp(ADDR_TAG_PTR(q[idx[lo]].addr), tp, ADDR_TAG_LEN) != 0)
+            continue;
+      /* n is record number in ledger.dat */
+      if(fseek(fp, n * sizeof(le), SEEK_SET) != 0
+         || fread(&le, sizeof(le), 1, fp) != 1
+         || memcmp(ADDR_TAG_PTR(le.addr), tp, ADDR_TAG_LEN) != 0) {
+         fclose(fp);
+         tag_free();  /* Erase the bad index */
+         error("tag_findq(): bad index at %u", n);
+         return -1;
+      }
+      for( ; lo < count; lo++) {
+         qp = &q[idx[lo]];
+         if(memcmp(ADDR_TAG_PTR(qp->addr), tp, ADDR_TAG_LEN) != 0) break;
+         if(!iszero(qp->addr, TXADDRLEN - ADDR_TAG_LEN)) continue;  /* done */
+         memcpy(qp->addr, le.addr, TXADDRLEN);
+         memcpy(qp->balance, le.balance, TXAMOUNT);
+         left--;
+         found++;
+      }
+   }  /* end for tp */
+   fclose(fp);
+   return found;
+}  /* end tag_findq() */
+
+
 /* Validate TX address tags.
  * If called from tx_val(), bnum is NULL in order to check
  * queues, txq1.dat and txclean.dat, and always do dst check.
@@ -0,0 +1,184 @@
+/* testpow.c  Test pow_list() and pow_first() from powval.c against
+              a serial pow_val() loop on synthetic trailer sets.
+
+   peach() and trigg_check() are replaced by a check that fails
+   trailers marked in mroot[0] and takes Workloops of time.
+
+   See LICENSE.PDF
+
+   Date: 19 October 2026
+*/
+
+
+#include "../config.h"
+#include "../mochimo.h"
+#include <sys/time.h>
+
+#define BADMARK 0xee
+
+int Trace;
+word32 Workloops = 20000;
+
+word32 get32(void *buff)
+{
+   return *((word32 *) buff);
+}
+
+void put32(void *buff, word32 val)
+{
+   *((word32 *) buff) = val;
+}
+
+/* buff<--val */
+void put64(void *buff, void *val)
+{
+   ((word32 *) buff)[0] = ((word32 *) val)[0];
+   ((word32 *) buff)[1] = ((word32 *) val)[1];
+}
+
+void plog(char *fmt, ...)
+{
+   va_list argp;
+
+   va_start(argp, fmt);
+   vfprintf(stdout, fmt, argp);
+   va_end(argp);
+   printf("\n");
+}
+
+int error(char *fmt, ...)
+{
+   va_list argp;
+
+   va_start(argp, fmt);
+   vfprintf(stdout, fmt, argp);
+   va_end(argp);
+   printf("\n");
+   return VERROR;
+}
+
+void work(void)
+{
+   volatile word32 x;
+   word32 j;
+
+   for(x = j = 0; j < Workloops; j++) x += j;
+}
+
+
+long msec(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+int peach(BTRAILER *bt, word32 difficulty, word32 *hps, int mode)
+{
+   (void) difficulty;
+   (void) hps;
+   (void) mode;
+   work();
+   return bt->mroot[0] == BADMARK;
+}
+
+char *trigg_check(byte *in, byte d, byte *bnum)
+{
+   (void) d;
+   (void) bnum;
+   work();
+   return in[0] == BADMARK ? NULL : "ok";
+}
+
+#include "../add64.c"
+#include "../powval.c"
+
+
+/* the check as checkproof() and tfval2() did it: one at a time */
+word32 pow_serial(BTRAILER *list, word32 count)
+{
+   word32 j;
+
+   for(j = 0; j < count; j++)
+      if(pow_val(&list[j]) != VEOK) break;
+   return j;
+}
+
+
+/* Fill count trailers from bnum with every kind of trailer,
+ * and mark nbad of them at random as bad work.
+ */
+void mkset(BTRAILER *list, word32 count, word32 bnum, int nbad)
+{
+   word32 j;
+
+   memset(list, 0, count * sizeof(BTRAILER));
+   for(j = 0; j < count; j++, bnum++) {
+      put32(list[j].bnum, bnum);
+      put32(list[j].difficulty, 18);
+      if(rand() % 10) put32(list[j].tcount, 1);  /* else pseudoblock */
+   }
+   while(count && nbad-- > 0) list[rand() % count].mroot[0] = BADMARK;
+}
+
+
+int main()
+{
+   static BTRAILER list[4000];
+   static word32 sizes[] = { 0, 1, 2, 54, 55, 1000, 4000 };
+   static int procs[] = { 1, 2, 3, 8, 0 };
+   word32 n, r1, r2, r3, bnum;
+   int j, k, t, nbad, errors = 0;
+   FILE *fp;
+   long stime;
+
+   srand(1);
+   for(j = 0; j < (int) (sizeof(sizes) / sizeof(word32)); j++) {
+      n = sizes[j];
+      for(t = 0; t < 4; t++) {
+         nbad = t == 0 ? 0 : t * 2 - 1;
+         /* below and above V24TRIGGER for trigg_check() and peach() */
+         bnum = t & 1 ? V24TRIGGER - n / 2 : 0x100000 - n / 2;
+         mkset(list, n, bnum, nbad);
+         r1 = pow_serial(list, n);
+         fp = fopen("testpow.dat", "wb");
+         fwrite(list, sizeof(BTRAILER), 3, fp);  /* to skip */
+         fwrite(list, sizeof(BTRAILER), n, fp);
+         fclose(fp);
+         for(k = 0; k < (int) (sizeof(procs) / sizeof(int)); k++) {
+            Powprocs = procs[k];
+            r2 = pow_list(list, n);
+            fp = fopen("testpow.dat", "rb");
+            r3 = pow_first(fileno(fp), 3 * sizeof(BTRAILER), 0);
+            fclose(fp);
+            if(r2 != r1 || r3 != r1) {
+               printf("Error! count %u bad %d procs %d: serial %u"
+                      " list %u file %u\n", n, nbad, Powprocs, r1, r2, r3);
+               errors++;
+            }
+         }
+      }
+   }
+   unlink("testpow.dat");
+
+   /* time a proof with a bad trailer at the end and checks
+    * of about a millisecond
+    */
+   Workloops = 400000;
+   mkset(list, 54, 0x10000, 0);
+   list[53].mroot[0] = BADMARK;
+   Powprocs = 0;
+   stime = msec();
+   for(j = 0; j < 20; j++)
+      if(pow_list(list, 54) != 53) errors++;
+   printf("pow_list(): %ld ms per 54 trailer proof\n", (msec() - stime) / 20);
+   stime = msec();
+   for(j = 0; j < 20; j++)
+      if(pow_serial(list, 54) != 53) errors++;
+   printf("serial:     %ld ms per 54 trailer proof\n", (msec() - stime) / 20);
+
+   if(errors) printf("%d errors.\n", errors);
+   else printf("Success!\n");
+   return errors ? 1 : 0;
+}
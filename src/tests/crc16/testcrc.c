@@ -0,0 +1,64 @@
+/* testcrc.c  Test slice-by-8 crc16() against the byte-at-a-time CRC
+              and time both on a TXBUFFLEN packet.
+
+   See LICENSE.PDF
+
+   Date: 19 October 2026
+*/
+
+
+#include "../config.h"
+#include "../mochimo.h"
+#include <time.h>
+
+#include "../crypto/crc16.c"
+
+/* the CRC as it was: one byte at a time */
+word16 crc16_byte(void *buff, int len)
+{
+   word16 crc = 0;
+   byte *bp;
+
+   for(bp = buff; len; len--, bp++)
+      crc = update_crc16(crc, *bp);
+   return crc;
+}
+
+
+int main()
+{
+   static byte buff[TXBUFFLEN + 8];
+   int j, off, len, errors;
+   long n, loops;
+   clock_t t;
+   double t1, t8;
+   word16 sum;
+
+   srand(1);  /* same packet every run */
+   for(j = 0; j < (int) sizeof(buff); j++) buff[j] = rand();
+
+   /* every short length at every alignment, then the packet sizes */
+   errors = 0;
+   for(off = 0; off < 8; off++) {
+      for(len = 0; len < 100; len++)
+         if(crc16(buff + off, len) != crc16_byte(buff + off, len)) errors++;
+      len = TXBUFFLEN - (2+2);  /* CRC_COUNT */
+      if(crc16(buff + off, len) != crc16_byte(buff + off, len)) errors++;
+   }
+   /* check value of CRC-CCITT (XMODEM) */
+   if(crc16("123456789", 9) != 0x31c3) errors++;
+   printf("crc16(): %d errors\n", errors);
+
+   loops = 100000;
+   sum = 0;
+   t = clock();
+   for(n = 0; n < loops; n++) sum ^= crc16_byte(buff, TXBUFFLEN - 4);
+   t1 = (double) (clock() - t) / CLOCKS_PER_SEC;
+   t = clock();
+   for(n = 0; n < loops; n++) sum ^= crc16(buff, TXBUFFLEN - 4);
+   t8 = (double) (clock() - t) / CLOCKS_PER_SEC;
+   printf("%d byte packet: byte-at-a-time %.2f us, slice-by-8 %.2f us"
+          "  (%.1fx)  [%04x]\n", TXBUFFLEN - 4, t1 * 1e6 / loops,
+          t8 * 1e6 / loops, t8 > 0 ? t1 / t8 : 0.0, sum);
+   return errors ? 1 : 0;
+}
@@ -30,6 +30,9 @@ void stop_mirror(void)
    }
 }  /* end stop_mirror() */
 
+/* no query workers here */
+void stop_query(void) { }
+
 
 int main()
 {
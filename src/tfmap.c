@@ -0,0 +1,98 @@
+/* tfmap.c  Read-only map of tfile.dat with running weights.
+ *
+ * Copyright (c) 2019 by Adequate Systems, LLC.  All Rights Reserved.
+ * See LICENSE.PDF   **** NO WARRANTY ****
+ *
+ * Date: 19 October 2026
+ *
+ * tfmap() maps tfile.dat again when it has changed since the last call,
+ * so readtf() and past_weight() need not open and read it trailer by
+ * trailer.  Tfsum[n] is the sum of 2**difficulty over trailers 1..n,
+ * leaving out neo-genesis blocks as past_weight() does.  When the file
+ * has only grown, the sums are extended from the last trailer mapped.
+*/
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+BTRAILER *Tfmap;        /* mapped trailers */
+word32 Ntfmap;          /* count of mapped trailers */
+byte (*Tfsum)[HASHLEN]; /* running weight after each trailer */
+word32 Ntfsum;          /* entries allocated in Tfsum[] */
+struct stat Tfstat;     /* of the mapped tfile.dat */
+byte Tflasthash[HASHLEN];  /* bhash of last mapped trailer */
+
+
+/* Drop the map of tfile.dat. */
+void tfunmap(void)
+{
+   if(Tfmap) munmap(Tfmap, Tfstat.st_size);
+   Tfmap = NULL;
+   Ntfmap = 0;
+}
+
+
+/* Map tfile.dat if it is not the file we have mapped.
+ * Returns VEOK if Tfmap[] and Tfsum[] are good, else VERROR.
+ */
+int tfmap(void)
+{
+   struct stat st;
+   BTRAILER *bp;
+   byte (*sp)[HASHLEN];
+   word32 j, n;
+   int fd;
+
+   if(stat("tfile.dat", &st) != 0) {
+      tfunmap();
+      return VERROR;
+   }
+   if(Tfmap && st.st_ino == Tfstat.st_ino && st.st_size == Tfstat.st_size
+      && st.st_mtime == Tfstat.st_mtime) return VEOK;
+
+   fd = open("tfile.dat", O_RDONLY);
+   if(fd == -1 || fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(BTRAILER)
+      || (st.st_size % sizeof(BTRAILER)) != 0) {
+      if(fd != -1) close(fd);
+      tfunmap();
+      return VERROR;
+   }
+   bp = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if(bp == MAP_FAILED) {
+      tfunmap();
+      return VERROR;
+   }
+   n = st.st_size / sizeof(BTRAILER);
+   if(n > Ntfsum) {
+      sp = realloc(Tfsum, (n + TFSUMEXTRA) * HASHLEN);
+      if(sp == NULL) {
+         munmap(bp, st.st_size);
+         tfunmap();
+         return error("tfmap(): no memory for %u weights", n);
+      }
+      Tfsum = sp;
+      Ntfsum = n + TFSUMEXTRA;
+   }
+
+   /* keep the sums if tfile.dat was only appended to */
+   j = 0;
+   if(Tfmap && st.st_ino == Tfstat.st_ino && n >= Ntfmap
+      && memcmp(bp[Ntfmap - 1].bhash, Tflasthash, HASHLEN) == 0) j = Ntfmap;
+   tfunmap();
+   Tfmap = bp;
+   Ntfmap = n;
+   Tfstat = st;
+   if(j == 0) {
+      memset(Tfsum[0], 0, HASHLEN);
+      j = 1;
+   }
+   for( ; j < n; j++) {
+      memcpy(Tfsum[j], Tfsum[j - 1], HASHLEN);
+      if((j & 0xff) == 0) continue;  /* skip NG blocks */
+      add_weight2(Tfsum[j], Tfmap[j].difficulty[0]);
+   }
+   memcpy(Tflasthash, Tfmap[n - 1].bhash, HASHLEN);
+   if(Trace) plog("tfmap(): %u trailers", Ntfmap);
+   return VEOK;
+}  /* end tfmap() */
@@ -29,7 +29,19 @@
 #define OP_HASH           17
 #define OP_TF             18
 #define OP_IDENTIFY       19
-#define LAST_OP           19  /* edit when adding  OP's */
+#define OP_GETBLOCKS      20  /* C_OPX: run of blocks in one session */
+#define OP_GET_RANGE      21  /* C_OPX: part of a block or tfile.dat */
+#define OP_GETCOMPACT     22  /* C_OPX: block with CTXENTRY's for TX's */
+#define OP_GETTXS         23  /* C_OPX: listed TXQENTRY's of a block */
+#define OP_BALANCES       24  /* C_OPX: many balances and tags at once */
+#define LAST_OP           24  /* edit when adding  OP's */
+#define MAX_OP            63  /* OP's above LAST_OP up to here get OP_NACK */
+
+/* Request classes from op_class() in order of dispatch() */
+#define PRI_FOUND         0  /* OP_FOUND */
+#define PRI_SYNC          1  /* blocks, tfile, TX, and the rest */
+#define PRI_QUERY         2  /* balance, resolve, ip list, identify */
+#define NPRI              3
 
 #define TXNETWORK 0x0539
 #define TXEOT     0xabcd
@@ -42,8 +54,11 @@
 #define TRANBUFF(tx) ((tx)->src_addr)
 /*                      addresses        amounts    signature  crc + trailer */
 #define TRANLEN      ( (TXADDRLEN*3) + (TXAMOUNT*3) + TXSIGLEN )
+#define BALPKT       (TRANLEN / TXADDRLEN)  /* queries in OP_BALANCES */
 #define SIG_HASH_COUNT (TRANLEN - TXSIGLEN)
 #define TXBUFF(tx)   ((byte *) tx)
+/* TX header length: version through len[] */
+#define TXHDRLEN   ((2*5) + (8*2) + 32 + 32 + 32 + 2)
 /* for struct size checking: */
 #define TXBUFFLEN  ((2*5) + (8*2) + 32 + 32 + 32 + 2 \
                       + (TXADDRLEN*3) + (TXAMOUNT*3) + TXSIGLEN + (2+2) )
@@ -64,6 +79,13 @@
 #define C_SANCTUARY 4
 #define C_MFEE      8
 #define C_LOGGING   16
+#define C_VLEN      32  /* sends variable length packets -- tx_paylen() */
+#define C_OPX       64  /* NACKs unknown OP's to MAX_OP: try OP's > 19 */
+
+/* Packet is sent short if both ends have C_VLEN.  OP_HELLO is always
+ * full length since the caller does not yet know the peer's Cbits.
+ */
+#define isvlen(cbits, op)  ((Cbits & (cbits) & C_VLEN) && (op) != OP_HELLO)
 
 /* Multi-byte numbers are little-endian.
  * Structure is checked on start-up for byte-alignment.
@@ -95,6 +117,14 @@ typedef struct {
 } TX;
 
 
+/* OP_GET_RANGE request at TRANBUFF(tx) */
+typedef struct {
+   byte opcode[2];   /* OP_GETBLOCK (of tx.blocknum) or OP_GET_TFILE */
+   byte offset[4];   /* first byte of file to send */
+   byte length[4];   /* count of bytes to send, or zero for to EOF */
+} RANGEREQ;
+
+
 typedef struct {
    TX tx;  /* transaction buffer */
    word16 id1;      /* from tx */
@@ -103,8 +133,34 @@ typedef struct {
    word32 src_ip;
    SOCKET sd;
    pid_t pid;     /* process id of child -- zero if empty slot */
+   byte cbits;    /* peer capability bits from tx.version[1] */
 } NODE;
 
+/* A fetch_blocks() child and her pipes */
+typedef struct {
+   pid_t pid;     /* zero if none */
+   int rfd;       /* a byte for each block she delivers */
+   int wfd;       /* block numbers that fetch_wait() waits for */
+} FETCH;
+
+/* A query passed to a query worker, with our chain head when sent */
+typedef struct {
+   NODE node;
+   byte cblock[8];        /* Cblocknum */
+   byte cblockhash[32];   /* Cblockhash */
+   byte pblockhash[32];   /* Prevhash */
+   byte weight[32];       /* Weight */
+} QUERYMSG;
+
+/* A connection accepted by server() and waiting to be served */
+typedef struct {
+   NODE node;     /* node.sd is INVALID_SOCKET if slot is empty */
+   time_t time;   /* accept() time */
+   int pri;       /* op_class() once gettx() has read it, else -1 */
+   int step;      /* gettx(): 0 new, 1 wait OP_HELLO, 2 wait request */
+   int got;       /* gettx(): bytes of the packet read so far */
+} PENDING;
+
 
 /* Structure for clean TX que */
 typedef struct {
@@ -120,6 +176,13 @@ typedef struct {
 } TXQENTRY;
 
 
+/* Stands for a TXQENTRY in a block sent with OP_GETCOMPACT */
+typedef struct {
+   byte tx_id[HASHLEN];
+   byte crc[4];                  /* crc32 of the whole TXQENTRY */
+} CTXENTRY;
+
+
 /* The block header */
 typedef struct {
    byte hdrlen[4];         /* header length to tran array */
@@ -147,6 +210,66 @@ typedef struct {
    byte bhash[HASHLEN];  /* hash of all block less bhash[] */
 } BTRAILER;
 
+
+/* Recent TX for txseen() */
+typedef struct {
+   byte tx_id[HASHLEN];   /* sha256 of src_addr */
+   time_t time;           /* zero if empty */
+} TXSEEN;
+
+
+/* Token bucket for limit.c */
+typedef struct {
+   word32 ip;       /* zero for a bucket not keyed by ip */
+   word32 tokens;   /* in 1/1000's of a token */
+   word32 time;     /* mtime() of last refill */
+} BUCKET;
+
+
+/* Peer score entry in shared memory and peers.dat */
+typedef struct {
+   word32 ip;
+   word32 rtt;      /* ms to connect and get HELLO_ACK, moving average */
+   word32 rate;     /* download bytes per second, moving average */
+   word16 ok;       /* good calls */
+   word16 fail;     /* calls refused or timed out */
+   word16 nack;     /* requests answered with OP_NACK */
+   word16 bad;      /* bad blocks or protocol errors */
+   word32 seen;     /* time of last update */
+} PEERSCORE;
+
+
+/* Running state of tfile validation, between trailers */
+typedef struct {
+   byte bnum[8];             /* bnum expected in next trailer */
+   byte weight[HASHLEN];     /* chain weight so far */
+   byte prevhash[HASHLEN];   /* bhash of last trailer */
+   word32 difficulty;        /* difficulty expected in next trailer */
+   word32 time1;             /* stime of last trailer */
+} TFSTATE;
+
+/* Slot in powcache.dat of a trailer with good work */
+typedef struct {
+   byte thash[HASHLEN];      /* sha256 of the whole trailer */
+   byte difficulty[4];       /* its difficulty */
+   byte sigs;                /* non-zero if its block's signatures are good */
+   byte pad[3];
+} POWCACHE;
+
+/* Checkpoint of tfile validation in tfile.chk */
+typedef struct {
+   TFSTATE ts;               /* state after the validated trailers */
+   byte tfhash[HASHLEN];     /* sha256 of those trailers in tfile.dat */
+   byte hash[HASHLEN];       /* sha256 of the above */
+} TFCHECK;
+
+/* Trusted checkpoint of tfile.dat, see chkpoint.c */
+typedef struct {
+   word32 bnum;              /* block number */
+   byte bhash[HASHLEN];      /* its block hash */
+   byte tfhash[HASHLEN];     /* sha256 of trailers 0 through bnum */
+} CHECKPOINT;
+
 #define BTSIZE (32+8+8+4+4+4+32+32+4+32)
 
 
@@ -156,6 +279,13 @@ typedef struct {
    byte balance[TXAMOUNT];  /* 8 */
 } LENTRY;
 
+/* Ledger entry as it was before a block, in undo/u<bnum>.dat */
+typedef struct {
+   LENTRY le;                /* old entry, or just the address */
+   byte found;               /* 0 if the address was not in the ledger */
+   byte pad[7];
+} LUNDO;
+
 /* ledger transaction ltran.tmp, el.al. */
 typedef struct {
    byte addr[TXADDRLEN];    /* 2208 */
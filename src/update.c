@@ -7,14 +7,40 @@
  * Updated: 15 December 2019
 */
 
+/* Create a grandchild to send OP_FOUND with proof in tx to ip.
+ * Returns pid of grandchild, or 0 if fork() fails.
+ */
+pid_t found1(word32 ip, TX *tx)
+{
+   pid_t pid;
+   NODE node;
+
+   pid = fork();
+   if(pid < 0) {
+      error("found1(): Cannot fork()");
+      return 0;  /* to parent */
+   }
+   if(pid) return pid;  /* to parent */
+
+   /* in (grand) child */
+   signal(SIGTERM, SIG_DFL);
+   signal(SIGALRM, SIG_DFL);  /* per peer deadline */
+   alarm(FOUNDTIME);
+   if(callserver(&node, ip) != VEOK) exit(1);
+   memcpy(&node.tx, tx, sizeof(TX));  /* copy in tfile proof */
+   send_op(&node, OP_FOUND);
+   closesocket(node.sd);
+   exit(0);
+}  /* end found1() */
+
+
 /* Creates child to send OP_FOUND to all recent peers */
 int send_found(void)
 {
-   word32 *ipp;
-   NODE node;
    BTRAILER bt;
    char fname[128];
-   int ecode;
+   int ecode, j, len;
+   word32 ip;
    TX tx;
 
    if(Sendfound_pid) {
@@ -32,6 +58,7 @@ int send_found(void)
    if(Sendfound_pid) return VEOK;          /* parent returns */
 
    /* in child */
+   signal(SIGTERM, SIG_DFL);  /* grandchildren keep their own deadline */
    show("found_child");
 
    /* Check if "found" NG block v.23 */
@@ -57,23 +84,20 @@ bad:
       plog("send_found(0x%s)", bnum2hex(Cblocknum));
 
    loadproof(&tx);  /* get proof from tfile.dat */
-   /* Send found message to recent peers */
-   shuffle32(Rplist, RPLISTLEN);
-   for(ipp = Rplist; ipp < &Rplist[RPLISTLEN] && Running; ipp++) {
-      if(*ipp == 0) continue;
-      if(callserver(&node, *ipp) != VEOK) continue;
-      memcpy(&node.tx, &tx, sizeof(TX));  /* copy in tfile proof */
-      send_op(&node, OP_FOUND);
-      closesocket(node.sd);
-   }
-   /* Send found message to local peers */
-   for(ipp = Lplist; ipp < &Lplist[LPLISTLEN] && Running; ipp++) {
-      if(*ipp == 0) continue;
-      if(callserver(&node, *ipp) != VEOK) continue;
-      memcpy(&node.tx, &tx, sizeof(TX));  /* copy in tfile proof */
-      send_op(&node, OP_FOUND);
-      closesocket(node.sd);
+   /* Send found message to recent and local peers all at once,
+    * each once, so that a slow or dead peer does not hold up the rest.
+    */
+   len = 0;
+   for(j = 0; j < RPLISTLEN + LPLISTLEN; j++) {
+      ip = j < RPLISTLEN ? Rplist[j] : Lplist[j - RPLISTLEN];
+      if(ip == 0 || search32(ip, Splist, len)) continue;
+      Splist[len++] = ip;
    }
+   for(j = 0; j < len; j++)
+      found1(Splist[j], &tx);  /* grandchild */
+
+   /* each grandchild exits or dies on her own alarm(FOUNDTIME) */
+   while(waitpid(-1, NULL, 0) > 0 || errno == EINTR);
    exit(0);
 }  /* end send_found() */
 
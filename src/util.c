@@ -501,6 +501,47 @@ void crctx(TX *tx)
 }
 
 
+/* Return count of transaction buffer bytes that a short (C_VLEN) packet
+ * carries for tx->opcode.  Both ends compute this from the header.
+ */
+int tx_paylen(TX *tx)
+{
+   word16 len;
+
+   switch(get16(tx->opcode)) {
+      case OP_HELLO:
+      case OP_HELLO_ACK:
+      case OP_GETBLOCK:
+      case OP_GETBLOCKS:
+      case OP_GETCOMPACT:
+      case OP_GETIPL:    /* len is the wallet flag */
+      case OP_BUSY:
+      case OP_NACK:
+      case OP_GET_TFILE:
+      case OP_GET_CBLOCK:
+      case OP_MBLOCK:
+      case OP_TF:
+         return 0;
+      case OP_SEND_BL:
+      case OP_SEND_IP:
+      case OP_HASH:
+      case OP_GETTXS:
+      case OP_BALANCES:
+         len = get16(tx->len);
+         return len > TRANLEN ? TRANLEN : len;
+      case OP_GET_RANGE:
+         return sizeof(RANGEREQ);
+      case OP_BALANCE:
+         return TXADDRLEN;
+      case OP_SEND_BAL:
+         return (TXADDRLEN*3) + TXAMOUNT;
+      case OP_RESOLVE:
+         return (TXADDRLEN*3) + (TXAMOUNT*2);
+   }
+   return TRANLEN;  /* OP_TX, OP_FOUND, and the rest */
+}  /* end tx_paylen() */
+
+
 /* Compute mining reward and copy to reward
  * It is a function of block number:
  *
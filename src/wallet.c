@@ -49,8 +49,12 @@ unsigned sleep(unsigned seconds);
 #define OP_HELLO_ACK      2
 #define OP_TX             3
 #define OP_GETIPL         6
+#define OP_SEND_BL        7
 #define OP_BALANCE        12
 #define OP_RESOLVE        14
+#define OP_BALANCES       24
+
+#define C_OPX             64  /* server has OP_BALANCES */
 
 #define W_TAG    1
 #define W_SEC    2
@@ -72,6 +76,7 @@ unsigned sleep(unsigned seconds);
                         + (TXADDRLEN*3) + (TXAMOUNT*3) + TXSIGLEN + (2+2) )
 #define TRANBUFF(tx) ((tx)->src_addr)
 #define TRANLEN      ( (TXADDRLEN*3) + (TXAMOUNT*3) + TXSIGLEN )
+#define BALPKT       (TRANLEN / TXADDRLEN)  /* queries in OP_BALANCES */
 #define SIG_HASH_COUNT (TRANLEN - TXSIGLEN)
 
 #define CRC_BUFF(tx) TXBUFF(tx)
@@ -1998,10 +2003,77 @@ out:
 }  /* end import_addr() */
 
 
+/* Check balances of count addresses from 1-based index first
+ * with one OP_BALANCES request.
+ * Return VEOK on success, else VERROR to check one at a time.
+ */
+int query_bals(unsigned first, unsigned count)
+{
+   NODE node;
+   WENTRY entry;
+   WINDEX *ip;
+   byte *buff, *bp;
+   unsigned j, k, len, n;
+   int ecode;
+
+   /* reply is a ledger entry of address and balance for each */
+   buff = malloc(count * (TXADDRLEN + TXAMOUNT));
+   if(buff == NULL) return VERROR;
+   ecode = VERROR;
+   if(callserver(&node, 0, Peeraddr) != VEOK) goto out;
+   if((node.tx.version[1] & C_OPX) == 0) goto done;  /* older server */
+
+   /* Send the addresses, BALPKT to a packet, ending with a short one. */
+   for(j = 0; ; ) {
+      for(k = 0; k < BALPKT && j < count; k++, j++) {
+         if(read_wentry(&entry, first + j - 1) != VEOK) goto done;
+         memcpy(TRANBUFF(&node.tx) + k * TXADDRLEN, entry.addr, TXADDRLEN);
+      }
+      put16(node.tx.len, k * TXADDRLEN);
+      if(send_op(&node, OP_BALANCES) != VEOK) goto done;
+      if(k < BALPKT) break;
+   }
+   for(n = 0; ; ) {
+      if(rx2(&node, 1) != VEOK) goto done;
+      if(get16(node.tx.opcode) != OP_SEND_BL) goto done;
+      len = get16(node.tx.len);
+      if(len > TRANLEN || n + len > count * (TXADDRLEN + TXAMOUNT)) goto done;
+      memcpy(buff + n, TRANBUFF(&node.tx), len);
+      n += len;
+      if(len < TRANLEN) break;
+   }
+   if(n != count * (TXADDRLEN + TXAMOUNT)) goto done;
+
+   for(j = 0, bp = buff; j < count; j++, bp += TXADDRLEN + TXAMOUNT) {
+      if(read_wentry(&entry, first + j - 1) != VEOK) goto done;
+      /* the reply must be for the address we sent, with our tag if set */
+      len = TXADDRLEN;
+      if(ADDR_TAG_PTR(entry.addr)[0] == 0) len -= ADDR_TAG_LEN;
+      if(memcmp(bp, entry.addr, len) != 0) goto done;
+      ip = &Windex[first + j - 1];
+      put64(ip->balance, bp + TXADDRLEN);
+      put64(entry.balance, bp + TXADDRLEN);
+      if(cmp64(ip->balance, Zeros) != 0) {
+         ip->flags[0] &= ~(W_SPENT | W_DEL);
+         ip->flags[0] |= W_BAL;
+      }
+      if(write_wentry(&entry, first + j - 1) != VEOK) goto done;
+   }
+   ecode = VEOK;
+done:
+   closesocket(node.sd);
+out:
+   memset(&entry, 0, sizeof(WENTRY));  /* security */
+   memset(buff, 0, count * (TXADDRLEN + TXAMOUNT));
+   free(buff);
+   return ecode;
+}  /* end query_bals() */
+
+
 /* Check all balances. */
 int query_all(void)
 {
-   unsigned j;
+   unsigned j, n;
    int ecode;
    WINDEX *ip;
 
@@ -2009,7 +2081,13 @@ int query_all(void)
 
    Sigint = 0;
    ecode = VEOK;
-   for(ip = Windex, j = 1; j <= Nindex; ip++, j++) {
+   for(j = 1; j <= Nindex && Sigint == 0; j += n) {
+      n = Nindex - j + 1;
+      if(n > BALMAX) n = BALMAX;
+      if(query_bals(j, n) != VEOK) break;
+   }
+   /* the rest one at a time if the server cannot batch */
+   for(ip = &Windex[j - 1]; j <= Nindex; ip++, j++) {
       if(Sigint) break;
       ecode = check_bal(j);
       if(ecode != VEOK) break;